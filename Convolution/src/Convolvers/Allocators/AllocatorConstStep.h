@@ -13,6 +13,8 @@
  *********************************************************************/
 
 #pragma once
+#include <algorithm>
+
 #include "../ConvolutionDefines.h"
 
 namespace Convolution
@@ -36,9 +38,21 @@ namespace Convolution
 		OnGetKernelConstStep(
 			const GetDesc& memoryDesc) noexcept :
 			GetDesc{ memoryDesc },
-			its_index_end{ 0 }
+			its_index_end{ 0 },
+			its_index_limit{ GetDesc::allocated_memory() }
 		{}
 
+		/**
+		 * \brief The external boundary is reached
+		 * before the allocated memory is filled,
+		 * so the window does not grow beyond index_limit
+		 */
+		void set_external_boundary(size_t index_limit) noexcept
+		{
+			its_index_limit = (std::min)(index_limit, GetDesc::allocated_memory());
+			its_index_end = (std::min)(its_index_end, its_index_limit);
+		}
+
 		void on_extract() noexcept
 		{
 			// the data is going to be pulled from
@@ -70,9 +84,12 @@ namespace Convolution
 		}
 	protected:
 		size_t its_index_end;
+		// the window ends here at the external boundary,
+		// it is the allocated memory unless set_external_boundary()
+		size_t its_index_limit;
 		bool is_external_boundary_time() const
 		{
-			return idx_end() == MemoryDesc::allocated_memory();
+			return idx_end() >= its_index_limit;
 		}
 	};
 
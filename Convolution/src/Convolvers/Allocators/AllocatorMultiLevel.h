@@ -0,0 +1,320 @@
+/*****************************************************************//**
+ * \file   AllocatorMultiLevel.h
+ * \brief  The file contains allocator definitions for
+ * the MultiLevel regime simulations.
+ *
+ * It generalizes the two-level history of the MainStep regime.
+ * The time step is constant, as in ConstStep,
+ * but the flux history is stored in bins:
+ * the bins of the level k average 2^k time frames.
+ * Every level keeps less than 2*bins_per_level bins,
+ * once the limit is reached the two oldest bins
+ * of a level are merged into a bin of the next level.
+ * The bins beyond the external boundary are forgotten.
+ *
+ * So, the nmbr of bins, i.e., the flux memory and
+ * the convolution cost per time step, grows as
+ * log(frame_temporal_size / bins_per_level).
+ *
+ * The kernel is stored per lag, as in ConstStep,
+ * see CumulativeKernel for the sums of lags over a bin.
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#include <stdexcept>
+#include <vector>
+
+#include "AllocatorConstStep.h"
+
+namespace Convolution
+{
+	/**
+	 * @brief Layout of the bins, common
+	 * for the pusher and the extractor.
+	 *
+	 * The bins are ordered from the newest to the oldest,
+	 * the level does not decrease along the order.
+	 * The bin j covers the lags [lag_begin; lag_begin + bin_width(j)),
+	 * where lag_begin is the sum of the widths of the previous bins.
+	 */
+	struct LevelsDesc
+	{
+		/**
+		 * @param bins_per_level min nmbr of bins per level, >= 2
+		 * @param frame_temporal_size nmbr of lags
+		 * that participate in the convolution
+		 */
+		LevelsDesc(
+			size_t bins_per_level,
+			size_t frame_temporal_size) :
+			its_bins_per_level{ bins_per_level },
+			its_frame{ frame_temporal_size },
+			its_bin_count{ 0ull },
+			its_lag_span{ 0ull }
+		{
+			if (bins_per_level < 2)
+				throw std::runtime_error(
+					"LevelsDesc: at least two bins per level are required.");
+			level_bins.reserve(max_level_count());
+			its_merges.reserve(max_level_count());
+		}
+
+		size_t bins_per_level() const noexcept
+		{
+			return its_bins_per_level;
+		}
+
+		size_t bin_count() const noexcept
+		{
+			return its_bin_count;
+		}
+
+		size_t level_count() const noexcept
+		{
+			return level_bins.size();
+		}
+
+		/**
+		 * \brief Nmbr of bins at a level,
+		 * each of them averages 2^level time frames
+		 */
+		size_t level_bin_count(size_t level) const noexcept
+		{
+			return level_bins[level];
+		}
+
+		/**
+		 * \brief Nmbr of time frames covered by the bins
+		 */
+		size_t lag_span() const noexcept
+		{
+			return its_lag_span;
+		}
+
+		/**
+		 * \brief Positions of the bins merged
+		 * at the last time frame, in the order of the merges:
+		 * the bins p and p+1 become the bin p,
+		 * the next bins are moved by one to the newest.
+		 */
+		const std::vector<size_t>& merges() const noexcept
+		{
+			return its_merges;
+		}
+
+		/**
+		 * \brief Upper bound of the nmbr of levels:
+		 * all the levels but the last keep
+		 * at least bins_per_level bins,
+		 * and a level which starts beyond
+		 * the external boundary is forgotten
+		 */
+		size_t max_level_count() const noexcept
+		{
+			size_t levels = 1;
+			while (its_bins_per_level * ((size_t{ 1 } << levels) - 1) < its_frame)
+				++levels;
+			return levels + 1;
+		}
+
+		/**
+		 * \brief Upper bound of the nmbr of bins
+		 */
+		size_t bin_capacity() const noexcept
+		{
+			return 2 * its_bins_per_level * max_level_count() + 1;
+		}
+
+	protected:
+		const size_t its_bins_per_level;
+		const size_t its_frame;
+		// nmbr of bins per level
+		std::vector<size_t> level_bins;
+		size_t its_bin_count;
+		size_t its_lag_span;
+		std::vector<size_t> its_merges;
+
+		/**
+		 * \brief A new time frame becomes the newest bin
+		 */
+		void add_frame()
+		{
+			its_merges.clear();
+			if (level_bins.empty())
+				level_bins.push_back(0ull);
+			++level_bins[0];
+			++its_bin_count;
+			++its_lag_span;
+
+			size_t position = 0;
+			for (size_t level = 0; level < level_bins.size(); ++level)
+			{
+				position += level_bins[level];
+				if (level_bins[level] < 2 * its_bins_per_level)
+					continue;
+				// the two oldest bins of the level
+				// become the newest bin of the next level
+				if (level + 1 == level_bins.size())
+					level_bins.push_back(0ull);
+				level_bins[level] -= 2;
+				++level_bins[level + 1];
+				--its_bin_count;
+				position -= 2;
+				its_merges.push_back(position);
+			}
+
+			// the oldest bins beyond the external boundary
+			while (its_lag_span - oldest_bin_width() >= its_frame)
+			{
+				its_lag_span -= oldest_bin_width();
+				--level_bins.back();
+				--its_bin_count;
+				if (level_bins.back() == 0)
+					level_bins.pop_back();
+			}
+
+			// the next time frame must fit, too
+			if (its_bin_count >= bin_capacity())
+				throw std::runtime_error(
+					"LevelsDesc::add_frame() : the bin capacity is exceeded.");
+		}
+
+		size_t oldest_bin_width() const noexcept
+		{
+			return size_t{ 1 } << (level_bins.size() - 1);
+		}
+	};
+
+	/**
+	 * @brief
+	 * Concrete descriptor of data
+	 * that is going to be used for
+	 * convolution at a next time moment.
+	 *
+	 * It is for FLUX data (well or fracture)
+	 * at MultiLevel regime.
+	 * The window is all the bins,
+	 * the newest one is at the begin.
+	 */
+	struct OnGetFluxMultiLevel :
+		public GetDesc,
+		public LevelsDesc
+	{
+		OnGetFluxMultiLevel(
+			const GetDesc& memoryDesc,
+			const LevelsDesc& levelsDesc) :
+			GetDesc{ memoryDesc },
+			LevelsDesc{ levelsDesc }
+		{}
+
+		void on_extract()
+		{
+			// the layout follows the one of the pusher
+			LevelsDesc::add_frame();
+			GetDesc::cur_temporal_window = LevelsDesc::bin_count();
+		}
+
+		constexpr size_t idx_begin() const noexcept {
+			return 0ull;
+		}
+
+		size_t idx_end() const noexcept {
+			return LevelsDesc::bin_count() * GetDesc::spatial_size();
+		}
+	};
+
+	struct OnPushFluxMultiLevel :
+		public PushDesc,
+		public LevelsDesc
+	{
+		OnPushFluxMultiLevel(
+			const PushDesc& memoryDesc,
+			const LevelsDesc& levelsDesc) :
+			PushDesc{ memoryDesc },
+			LevelsDesc{ levelsDesc }
+		{}
+
+		void on_push()
+		{
+			++PushDesc::cur_temporal_window;
+			LevelsDesc::add_frame();
+#ifdef PUSHER_ADVANCE_FLAG
+			// since the data is pushed safely,
+			// it can be used later
+			PushDesc::need_advance = false;
+#endif
+		}
+
+		// the new time frame is always
+		// the first bin
+		constexpr size_t idx_begin() const noexcept {
+			return 0ull;
+		}
+
+		size_t idx_end() const noexcept {
+			return PushDesc::spatial_size();
+		}
+	};
+
+	/**
+	 * \brief The kernel is stored per lag,
+	 * it is the same as for the ConstStep.
+	 */
+	struct KernelMultiLevel :
+		public KernelConstStep
+	{
+		using KernelConstStep::KernelConstStep;
+	};
+
+	struct FluxMultiLevel
+		:
+		public Allocator
+		<
+		OnPushFluxMultiLevel,
+		OnGetFluxMultiLevel
+		>
+	{
+		/**
+		 * @param spatial_size nmbr of segments
+		 * of the source
+		 *
+		 * @param frame_temporal_size max nmbr
+		 * of time moments that participate
+		 * in the convolution
+		 *
+		 * @param bins_per_level min nmbr of bins per level,
+		 * the bins of the level 0 are the time frames,
+		 * so the last bins_per_level time frames are always exact
+		 */
+		FluxMultiLevel(
+			size_t spatial_size,
+			size_t frame_temporal_size,
+			size_t bins_per_level) :
+			FluxMultiLevel{
+				spatial_size,
+				LevelsDesc{ bins_per_level, frame_temporal_size } }
+		{}
+
+		size_t bin_capacity() const noexcept
+		{
+			return pusher.bin_capacity();
+		}
+
+	protected:
+		FluxMultiLevel(
+			size_t spatial_size,
+			const LevelsDesc& levelsDesc) :
+			Allocator<OnPushFluxMultiLevel,
+			OnGetFluxMultiLevel>{
+			OnPushFluxMultiLevel{
+				MemoryDesc{spatial_size, levelsDesc.bin_capacity()},
+				levelsDesc},
+			OnGetFluxMultiLevel{
+				MemoryDesc{spatial_size, levelsDesc.bin_capacity()},
+				levelsDesc} }
+		{}
+	};
+} // Convolution
@@ -0,0 +1,196 @@
+/*****************************************************************//**
+ * \file   AllocatorRingStep.h
+ * \brief  The file contains allocator definitions for
+ * fluxes stored in a ring buffer, see struct FluxRingStep.
+ *
+ * It is an alternative to FluxConstStep.
+ * The flux memory is bounded by the convolution window,
+ * frame_temporal_size, instead of the overall
+ * nmbr of time frames of the simulation.
+ *
+ * The indices are taken modulo ring_capacity().
+ * The storage maps its pages twice back to back
+ * (see Platform/MirroredBuffer.h), so a window
+ * [idx_begin(); idx_end()) is contiguous in memory
+ * even if it wraps around the end of the ring.
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#include "../ConvolutionDefines.h"
+#include "../Platform/MirroredBuffer.h"
+
+namespace Convolution
+{
+	/**
+	 * @brief Position of the data in the ring,
+	 * common for the pusher and the extractor.
+	 *
+	 * @param ring_capacity nmbr of doubles in the ring,
+	 * it is not less than spatial_size * frame_temporal_size
+	 * and is a multiple of the memory page
+	 */
+	struct RingDesc
+	{
+		RingDesc(size_t ring_capacity_) noexcept :
+			its_ring_capacity{ ring_capacity_ },
+			// initially begin points outside the ring,
+			// as there is no data yet
+			its_index_begin{ ring_capacity_ }
+		{}
+
+		size_t ring_capacity() const noexcept
+		{
+			return its_ring_capacity;
+		}
+
+		size_t idx_begin() const noexcept {
+			return its_index_begin;
+		}
+
+	protected:
+		const size_t its_ring_capacity;
+		size_t its_index_begin;
+
+		/**
+		 * \brief Moves the begin index back by count
+		 * in a closed loop
+		 */
+		void move_begin(size_t count) noexcept
+		{
+			its_index_begin = its_index_begin >= count ?
+				its_index_begin - count :
+				its_index_begin + its_ring_capacity - count;
+		}
+	};
+
+	/**
+	 * @brief
+	 * Concrete descriptor of data
+	 * that is going to be used for
+	 * convolution at a next time moment.
+	 *
+	 * It is for FLUX data (well or fracture)
+	 * stored in a ring.
+	 * The behavior is the same as for OnGetFluxConstStep:
+	 * the window grows until the external boundary
+	 * is reached, then it slides.
+	 *
+	 * idx_end() can exceed ring_capacity(),
+	 * but never exceeds 2*ring_capacity().
+	 */
+	struct OnGetFluxRingStep :
+		public GetDesc,
+		public RingDesc
+	{
+		OnGetFluxRingStep(
+			const GetDesc& memoryDesc,
+			size_t ring_capacity) noexcept :
+			GetDesc{ memoryDesc },
+			RingDesc{ ring_capacity }
+		{}
+
+		void on_extract() noexcept
+		{
+			if (!is_external_boundary_time())
+			{// the external boundary is not reached yet
+				++GetDesc::cur_temporal_window;
+			}
+			// otherwise the oldest frame is forgotten,
+			// since the window size is not changed
+			RingDesc::move_begin(GetDesc::spatial_size());
+		}
+
+		using RingDesc::idx_begin;
+
+		size_t idx_end() const noexcept {
+			return RingDesc::idx_begin() +
+				GetDesc::cur_temporal_window * GetDesc::spatial_size();
+		}
+
+	protected:
+		bool is_external_boundary_time() const
+		{
+			// the memory descriptor of the ring
+			// is allocated for the frame only
+			return
+				GetDesc::cur_temporal_window ==
+				GetDesc::temporal_size();
+		}
+	};
+
+	struct OnPushFluxRingStep :
+		public PushDesc,
+		public RingDesc
+	{
+		OnPushFluxRingStep(
+			const PushDesc& memoryDesc,
+			size_t ring_capacity) noexcept :
+			PushDesc{ memoryDesc },
+			RingDesc{ ring_capacity }
+		{}
+
+		void on_push() noexcept
+		{
+			// a new set of coefficients
+			// (per time moment) is added
+			// over the oldest one
+			++PushDesc::cur_temporal_window;
+			RingDesc::move_begin(PushDesc::spatial_size());
+#ifdef PUSHER_ADVANCE_FLAG
+			// since the data is pushed safely,
+			// it can be used later
+			PushDesc::need_advance = false;
+#endif
+		}
+
+		using RingDesc::idx_begin;
+
+		size_t idx_end() const noexcept {
+			return RingDesc::idx_begin() + PushDesc::spatial_size();
+		}
+	};
+
+	struct FluxRingStep
+		:
+		public Allocator
+		<
+		OnPushFluxRingStep,
+		OnGetFluxRingStep
+		>
+	{
+		/**
+		 * @param spatial_size nmbr of segments
+		 * of the source
+		 *
+		 * @param frame_temporal_size max nmbr
+		 * of time moments that participate
+		 * in the convolution. Only these moments are stored.
+		 */
+		FluxRingStep(
+			size_t spatial_size,
+			size_t frame_temporal_size) :
+			FluxRingStep{
+				MemoryDesc{spatial_size, frame_temporal_size},
+				MirroredBuffer::capacity_for(
+					spatial_size * frame_temporal_size) }
+		{}
+
+		size_t ring_capacity() const noexcept
+		{
+			return pusher.ring_capacity();
+		}
+
+	protected:
+		FluxRingStep(
+			const MemoryDesc& memoryDesc,
+			size_t ring_capacity) :
+			Allocator<OnPushFluxRingStep,
+			OnGetFluxRingStep>{
+			OnPushFluxRingStep{memoryDesc, ring_capacity},
+			OnGetFluxRingStep{memoryDesc, ring_capacity} }
+		{}
+	};
+} // Convolution
@@ -1,6 +1,9 @@
 #pragma once
-#include <vector>
+#include <algorithm>
 #include <cassert>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 /**
 * @brief This flag is for debug purpose only.
@@ -9,6 +12,19 @@
 */
 #define _PUSHER_ADVANCE_FLAG
 
+#undef OMPH_CODE			// use parallel version with openMP
+
+#ifndef PPL_CODE    // parallel code, using ppl
+#ifndef OMPH_CODE   // parallel code, using openMP
+#if defined(__linux__) && !defined(SEQUEN_CODE)
+#define POOL_CODE   // parallel code, using the persistent ThreadPool
+#endif
+#ifndef POOL_CODE
+#define SEQUEN_CODE // sequential code, MatrixXd*VectorXd is not done in parallel
+#endif
+#endif
+#endif
+
 namespace Convolution
 {
 	/**
@@ -226,6 +242,13 @@ namespace Convolution
 		size_t frac_count; // total number of fractures
 		size_t cur_frac_id; // the fracture id to be pushed to,
 		bool need_advance;
+		// per fracture, the push_generation it was last pushed at.
+		// A stamp is set by the thread which pushes the fracture,
+		// a stamp per fracture, so the threads never share a stamp
+		std::vector<size_t> pushed;
+		// it is changed by push_barrier() only,
+		// so it is only read while the fractures are pushed
+		size_t push_generation;
 	public:
 		MultipleFracturesContainer() = default;
 		/**
@@ -240,7 +263,9 @@ namespace Convolution
 			size_t frac_count) :
 			frac_count{ frac_count },
 			cur_frac_id{ 0 },
-			need_advance{ false }
+			need_advance{ false },
+			pushed(frac_count, 0ull),
+			push_generation{ 1ull }
 		{
 			data.reserve(frac_count);
 		}
@@ -264,6 +289,15 @@ namespace Convolution
 		{
 			return frac_count;
 		}
+
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			for (auto& fracture : data)
+				visitor.object(fracture);
+			visitor.pod(cur_frac_id);
+			visitor.pod(need_advance);
+		}
 		
 	protected:
 		/**
@@ -274,5 +308,47 @@ namespace Convolution
 		{
 			need_advance = true;
 		}
+
+		/**
+		 * \brief The data of a fracture is pushed,
+		 * it may be called concurrently for distinct fractures
+		 */
+		void on_push_done(size_t frac_id)
+		{
+			assert(frac_id < frac_count);
+			pushed[frac_id] = push_generation;
+		}
+
+		/**
+		 * \brief Completeness barrier: the data must be pushed
+		 * into every fracture since the previous barrier,
+		 * in the round-robin order or by the fracture id.
+		 * The threads which push concurrently must be joined before it.
+		 *
+		 * The barrier may be passed again until the next push,
+		 * e.g., by a second convolve() within the same time step.
+		 *
+		 * \param caller Name of the method for the error message
+		 * \return true if the data was pushed since the previous barrier,
+		 * false if the barrier is passed again within the time step
+		 */
+		bool push_barrier(const char* caller)
+		{
+			const size_t passed_generation = push_generation - 1;
+			if (passed_generation > 0 &&
+				std::all_of(pushed.begin(), pushed.end(),
+					[passed_generation](size_t stamp) { return stamp == passed_generation; }))
+				return false;
+
+			const auto missing = std::find_if(pushed.begin(), pushed.end(),
+				[this](size_t stamp) { return stamp != push_generation; });
+			if (missing != pushed.end())
+				throw std::runtime_error(std::string{ caller } +
+					" : the data was not pushed into fracture " +
+					std::to_string(missing - pushed.begin()) +
+					". Cannot proceed safely.");
+			++push_generation;
+			return true;
+		}
 	};
 } // Convolution
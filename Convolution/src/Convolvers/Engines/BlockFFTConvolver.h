@@ -0,0 +1,316 @@
+/*****************************************************************//**
+ * \file   BlockFFTConvolver.h
+ * \brief  The file contains an online convolution engine
+ * for the ConstStep regime, where the Kernel columns
+ * depend on the lag only.
+ *
+ * The direct product Kernel.middleCols(...) * flux.segment(...)
+ * costs O(n) per time step, so O(n^2) for the simulation.
+ * Here the lags are split into partitions of block_size lags
+ * (uniformly partitioned overlap-save):
+ *  - the partition 0 is convolved directly,
+ *	so the result of a time step is available at once;
+ *  - the partition which is being filled in by advance()
+ *	is convolved directly, too;
+ *  - the complete partitions are transformed once
+ *	and convolved in the frequency domain,
+ *	once per block_size time steps,
+ *	with a delay line of the input spectra.
+ *
+ * The cost per time step is
+ * O(rows * spatial_size * (block_size + n / block_size)
+ *	+ rows * log(block_size)),
+ * it is minimal for block_size ~ sqrt(frame_temporal_size).
+ *********************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <Eigen/Core>
+
+#include "FFT.h"
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * @brief A stateful replacement of
+	 * flux.extract().convolve(kernel) for the ConstStep regime.
+	 *
+	 * It must be called at every time step,
+	 * after the flux is pushed and extracted,
+	 * since it keeps the input history in its delay line:
+	 *		flux.extract();
+	 *		auto& res = convolver.convolve(kernel, flux);
+	 *
+	 * The kernel is extracted here (once), as it is by convolve().
+	 */
+	class BlockFFTConvolver
+	{
+	public:
+		/**
+		 * \param rows nmbr of mesh points, rows of the Kernel
+		 * \param spatial_size nmbr of segments of the source
+		 * \param frame_temporal_size nmbr of lags in the Kernel,
+		 * i.e., the external boundary
+		 * \param block_size nmbr of lags in a partition,
+		 * it must be a power of 2
+		 * \param tolerance if positive, every result is compared with
+		 * the direct product, and std::runtime_error is thrown
+		 * once the relative difference exceeds the tolerance
+		 */
+		BlockFFTConvolver(
+			size_t rows,
+			size_t spatial_size,
+			size_t frame_temporal_size,
+			size_t block_size = 64ull,
+			double tolerance = 0.0) :
+			fft{ 2 * block_size },
+			its_rows{ static_cast<Index>(rows) },
+			its_spatial_size{ static_cast<Index>(spatial_size) },
+			frame{ frame_temporal_size },
+			block{ block_size },
+			partition_count{ (frame_temporal_size + block_size - 1) / block_size },
+			tolerance{ tolerance },
+			its_max_error{ 0.0 },
+			step{ 0ull },
+			next_partition{ 1ull },
+			input_blocks{ MatrixXd::Zero(2 * block_size, spatial_size) },
+			spectrum_convolved(fft.bins(), rows),
+			block_convolved{ MatrixXd::Zero(rows, block_size) },
+			sequence(2, std::vector<double>(2 * block_size)),
+			spectrum(2, std::vector<FFT::complex>(fft.bins()))
+		{
+			const Index fft_cols = static_cast<Index>(
+				partition_count > 1 ? (partition_count - 1) * spatial_size : 0);
+			kernel_spectra.assign(fft.bins(), MatrixXcd::Zero(its_rows, fft_cols));
+			input_spectra.assign(fft.bins(), VectorXcd::Zero(fft_cols));
+		}
+
+		size_t block_size() const noexcept
+		{
+			return block;
+		}
+
+		/**
+		 * \brief Max relative difference from the direct product,
+		 * it is evaluated if the tolerance is positive
+		 */
+		double max_error() const noexcept
+		{
+			return its_max_error;
+		}
+
+		/**
+		 * \brief Result of convolution at the current time step
+		 * for all mesh points, the same as flux.convolve(kernel)
+		 * but for the extract() of the flux.
+		 */
+		template<typename Kernel_t, typename Flux_t>
+		const VectorXd& convolve(
+			const Kernel_t& kernel,
+			const Flux_t& flux)
+		{
+			const auto window = kernel();
+			const auto flux_window = flux();
+
+			const Index s = its_spatial_size;
+			const size_t lags = static_cast<size_t>(window.cols() / s);
+			if (window.rows() != its_rows ||
+				lags != (std::min)(step + 1, frame) ||
+				flux_window.size() != window.cols())
+				throw std::runtime_error(
+					"BlockFFTConvolver::convolve() : it must be called once per time step.");
+
+			const size_t block_id = step / block;
+			const size_t block_step = step % block;
+
+			if (block_step == 0 && block_id > 0)
+				on_block_begin();
+			input_blocks.row(static_cast<Index>(block + block_step)) =
+				flux_window.head(s).transpose();
+
+			// partition 0
+			const Index head = static_cast<Index>((std::min)(block, lags)) * s;
+			result.noalias() = window.leftCols(head) * flux_window.head(head);
+			if (block_id > 0)
+			{
+				result += block_convolved.col(static_cast<Index>(block_step));
+				// the partition which is being filled in
+				const size_t first_lag = block_id * block;
+				if (first_lag < lags)
+				{
+					const Index begin = static_cast<Index>(first_lag) * s;
+					const Index count = static_cast<Index>(lags - first_lag) * s;
+					result.noalias() +=
+						window.middleCols(begin, count) *
+						flux_window.segment(begin, count);
+				}
+			}
+
+			// the partitions completed at this time step
+			while (next_partition < partition_count &&
+				(std::min)((next_partition + 1) * block, frame) <= lags)
+			{
+				transform_partition(window, next_partition);
+				++next_partition;
+			}
+
+			if (tolerance > 0.0)
+				verify(window, flux_window);
+
+			++step;
+			return result;
+		}
+
+	protected:
+		/**
+		 * \brief The input block is complete:
+		 * its spectrum goes to the delay line,
+		 * and the complete partitions are convolved
+		 * for all the time steps of the next block
+		 */
+		void on_block_begin()
+		{
+			const Index s = its_spatial_size;
+			const Index fft_cols = static_cast<Index>(input_spectra[0].size());
+			const Index bins = static_cast<Index>(fft.bins());
+
+			if (fft_cols > 0)
+			{
+				for (auto& spectra : input_spectra)
+					spectra.tail(fft_cols - s) = spectra.head(fft_cols - s).eval();
+
+				// the last two input blocks, a sequence per segment
+				for (Index seg = 0; seg < s; seg += 2)
+				{
+					const bool has_pair = seg + 1 < s;
+					fft.forward_real(
+						input_blocks.col(seg).data(),
+						has_pair ? input_blocks.col(seg + 1).data() : nullptr,
+						spectrum[0].data(), spectrum[1].data());
+					for (Index bin = 0; bin < bins; ++bin)
+					{
+						input_spectra[bin](seg) = spectrum[0][bin];
+						if (has_pair)
+							input_spectra[bin](seg + 1) = spectrum[1][bin];
+					}
+				}
+
+				for (Index bin = 0; bin < bins; ++bin)
+					spectrum_convolved.row(bin).noalias() =
+						(kernel_spectra[bin] * input_spectra[bin]).transpose();
+
+				const Index B = static_cast<Index>(block);
+				for (Index row = 0; row < its_rows; row += 2)
+				{
+					const bool has_pair = row + 1 < its_rows;
+					fft.inverse_real(
+						spectrum_convolved.col(row).data(),
+						has_pair ? spectrum_convolved.col(row + 1).data() : nullptr,
+						sequence[0].data(), sequence[1].data());
+					// the second half is free of the circular aliasing
+					for (Index k = 0; k < B; ++k)
+					{
+						block_convolved(row, k) = sequence[0][B + k];
+						if (has_pair)
+							block_convolved(row + 1, k) = sequence[1][B + k];
+					}
+				}
+			}
+
+			input_blocks.topRows(block) = input_blocks.bottomRows(block);
+			input_blocks.bottomRows(block).setZero();
+		}
+
+		/**
+		 * \brief Spectra of the lags of a complete partition,
+		 * a sequence per (row; segment)
+		 */
+		template<typename Window>
+		void transform_partition(const Window& window, size_t partition_id)
+		{
+			const Index s = its_spatial_size;
+			const size_t first_lag = partition_id * block;
+			const size_t lag_count = (std::min)(block, frame - first_lag);
+			const Index col_begin = static_cast<Index>(partition_id - 1) * s;
+			const Index total = its_rows * s;
+
+			for (Index pair = 0; pair < total; pair += 2)
+			{
+				const Index count = (std::min)(Index{ 2 }, total - pair);
+				for (Index id = 0; id < count; ++id)
+				{
+					const Index row = (pair + id) % its_rows;
+					const Index seg = (pair + id) / its_rows;
+					std::fill(sequence[id].begin(), sequence[id].end(), 0.0);
+					for (size_t lag = 0; lag < lag_count; ++lag)
+						sequence[id][lag] = window(
+							row, static_cast<Index>(first_lag + lag) * s + seg);
+				}
+				fft.forward_real(
+					sequence[0].data(),
+					count > 1 ? sequence[1].data() : nullptr,
+					spectrum[0].data(), spectrum[1].data());
+				for (Index id = 0; id < count; ++id)
+				{
+					const Index row = (pair + id) % its_rows;
+					const Index seg = (pair + id) / its_rows;
+					for (size_t bin = 0; bin < fft.bins(); ++bin)
+						kernel_spectra[bin](row, col_begin + seg) = spectrum[id][bin];
+				}
+			}
+		}
+
+		template<typename Window, typename FluxWindow>
+		void verify(const Window& window, const FluxWindow& flux_window)
+		{
+			VectorXd direct = window * flux_window;
+			const double scale = (std::max)(1.0, direct.cwiseAbs().maxCoeff());
+			const double error = (result - direct).cwiseAbs().maxCoeff() / scale;
+			its_max_error = (std::max)(its_max_error, error);
+			if (error > tolerance)
+				throw std::runtime_error(
+					"BlockFFTConvolver::verify() : the result differs from the direct product.");
+		}
+
+	protected:
+		FFT fft;
+		const Index its_rows;
+		const Index its_spatial_size;
+		const size_t frame;
+		const size_t block;
+		// nmbr of partitions of block lags
+		const size_t partition_count;
+		const double tolerance;
+		double its_max_error;
+
+		// the current time step, from 0
+		size_t step;
+		// the partition to be transformed when it is complete
+		size_t next_partition;
+
+		// (2*block; spatial_size) the previous and the current input blocks,
+		// a column is the time sequence of a segment
+		MatrixXd input_blocks;
+		// per bin: (rows; (partitions-1)*spatial_size),
+		// the spectra of the partitions [1; partition_count)
+		std::vector<MatrixXcd> kernel_spectra;
+		// per bin: the delay line of the input spectra,
+		// its segment p-1 is convolved with the partition p
+		std::vector<VectorXcd> input_spectra;
+		// (bins; rows) spectra of the result
+		MatrixXcd spectrum_convolved;
+		// (rows; block) the frequency-domain part of the result
+		// for every time step of the current block
+		MatrixXd block_convolved;
+		VectorXd result;
+
+		// buffers for the pairs of real sequences
+		std::vector<std::vector<double>> sequence;
+		std::vector<std::vector<FFT::complex>> spectrum;
+	};
+} // Convolution
@@ -0,0 +1,414 @@
+/*****************************************************************//**
+ * \file   ConvolutionEngine.h
+ * \brief  The file contains engines that evaluate
+ * the product Kernel * Flux,
+ * i.e., the convolution for all the mesh points at once.
+ *
+ * An engine is a stateless class with a static method
+ * convolve(kernel_block, flux_block, out).
+ * The flux block is either a vector,
+ * or a matrix whose columns are convolved at once.
+ * The engine is chosen per regime through
+ * ConvolutionEngineSelector<Allocator_t>,
+ * which can be specialized for a particular flux allocator.
+ *
+ * The kernel block may be stored in a lower precision
+ * (float, bfloat16, half), see KernelStorageRAM_t,
+ * then it is converted to double by tiles
+ * and the product is accumulated in double, see KernelProduct.
+ *
+ * A kernel with row bands (see KernelBands) is convolved
+ * by BandedEngine, which multiplies only the nonzero rows.
+ *********************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <type_traits>
+#include <Eigen/Core>
+
+#include "../ConvolutionDefines.h"
+#include "ThreadPool.h"
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * @brief The product kernel * flux in double.
+	 *
+	 * A double kernel is multiplied by Eigen directly.
+	 * A kernel of a lower precision is converted to double
+	 * by tiles of (tile_rows; tile_cols), 64 KB of doubles,
+	 * which stay in the L2 cache between the conversion
+	 * and the product, so the kernel is read from the memory
+	 * in its own precision once, and no double copy
+	 * of the whole block is made.
+	 */
+	struct KernelProduct
+	{
+		static constexpr Index tile_rows{ 256 };
+		static constexpr Index tile_cols{ 32 };
+
+		/**
+		 * \brief out = kernel * flux
+		 */
+		template<typename KernelBlock, typename FluxBlock, typename Out>
+		static void assign(
+			const KernelBlock& kernel,
+			const FluxBlock& flux,
+			Out&& out)
+		{
+			if constexpr (is_double<KernelBlock>())
+				out.noalias() = kernel * flux;
+			else
+			{
+				out.resize(kernel.rows(), flux.cols());
+				out.setZero();
+				add(kernel, flux, out);
+			}
+		}
+
+		/**
+		 * \brief out += kernel * flux
+		 */
+		template<typename KernelBlock, typename FluxBlock, typename Out>
+		static void add(
+			const KernelBlock& kernel,
+			const FluxBlock& flux,
+			Out&& out)
+		{
+			if constexpr (is_double<KernelBlock>())
+				out.noalias() += kernel * flux;
+			else
+			{
+				// a tile per thread, it is allocated once
+				thread_local MatrixXd tile(tile_rows, tile_cols);
+				for (Index row = 0; row < kernel.rows(); row += tile_rows)
+				{
+					const Index rows = (std::min)(tile_rows, kernel.rows() - row);
+					for (Index col = 0; col < kernel.cols(); col += tile_cols)
+					{
+						const Index cols = (std::min)(tile_cols, kernel.cols() - col);
+						tile.topLeftCorner(rows, cols) =
+							kernel.block(row, col, rows, cols).template cast<double>();
+						out.middleRows(row, rows).noalias() +=
+							tile.topLeftCorner(rows, cols) *
+							flux.middleRows(col, cols);
+					}
+				}
+			}
+		}
+
+		template<typename KernelBlock>
+		static constexpr bool is_double()
+		{
+			return std::is_same<typename KernelBlock::Scalar, double>::value;
+		}
+	};
+
+	/**
+	 * @brief The product is evaluated by Eigen
+	 * in the calling thread
+	 */
+	struct SequentialEngine
+	{
+		template<typename KernelBlock, typename FluxBlock, typename Out>
+		static void convolve(
+			const KernelBlock& kernel,
+			const FluxBlock& flux,
+			Out& out)
+		{
+			KernelProduct::assign(kernel, flux, out);
+		}
+	};
+
+	/**
+	 * @brief The rows of the Kernel (mesh points) are split
+	 * into blocks which are convolved concurrently
+	 * by the threads of ThreadPool::instance().
+	 *
+	 * Every block is a multiple of the cache line,
+	 * but the output vector is not aligned to a cache line,
+	 * so two threads may share the cache line at the boundary
+	 * of their blocks, and only that one.
+	 */
+	struct RowPartitionedEngine
+	{
+		// nmbr of doubles in a cache line
+		static constexpr Index cache_line_size{ 64 / sizeof(double) };
+		// a block smaller than this is not worth a task
+		static constexpr Index min_block_rows{ 1024 };
+
+		/**
+		 * \brief Nmbr of rows convolved by a single task.
+		 * It is a multiple of the cache line,
+		 * so the blocks are not shorter than one
+		 */
+		static Index block_rows(Index rows, size_t thread_count)
+		{
+			Index block = rows / static_cast<Index>(thread_count) + 1;
+			block = (std::max)(block, min_block_rows);
+			return (block + cache_line_size - 1) / cache_line_size * cache_line_size;
+		}
+
+		template<typename KernelBlock, typename FluxBlock, typename Out>
+		static void convolve(
+			const KernelBlock& kernel,
+			const FluxBlock& flux,
+			Out& out)
+		{
+			ThreadPool& pool = ThreadPool::instance();
+			const Index rows = kernel.rows();
+			const Index block = block_rows(rows, pool.thread_count());
+			const size_t task_count = static_cast<size_t>((rows + block - 1) / block);
+
+			out.resize(rows, flux.cols());
+			if (task_count < 2ull)
+			{
+				SequentialEngine::convolve(kernel, flux, out);
+				return;
+			}
+
+			pool.parallel_for(task_count,
+				[&kernel, &flux, &out, rows, block](size_t task)
+				{
+					const Index begin = static_cast<Index>(task) * block;
+					const Index count = (std::min)(block, rows - begin);
+					KernelProduct::assign(
+						kernel.middleRows(begin, count), flux,
+						out.middleRows(begin, count));
+				});
+		}
+	};
+
+	/**
+	 * @brief The columns of the Kernel (lags) are split
+	 * into blocks. Every task convolves its block of lags
+	 * with the corresponding flux segment into a partial result,
+	 * and the partial results are summed up in the order of the blocks.
+	 *
+	 * It is intended for short and wide kernels,
+	 * e.g., fracture kernels with few rows and
+	 * fracNy * frame_temporal_size columns,
+	 * where splitting by rows gives no parallelism.
+	 */
+	struct ColumnPartitionedEngine
+	{
+		// a block smaller than this is not worth a task
+		static constexpr Index min_block_cols{ 256 };
+
+		/**
+		 * \brief Nmbr of columns convolved by a single task
+		 */
+		static Index block_cols(Index cols, size_t thread_count)
+		{
+			Index block = cols / static_cast<Index>(thread_count) + 1;
+			return (std::max)(block, min_block_cols);
+		}
+
+		template<typename KernelBlock, typename FluxBlock, typename Out>
+		static void convolve(
+			const KernelBlock& kernel,
+			const FluxBlock& flux,
+			Out& out)
+		{
+			ThreadPool& pool = ThreadPool::instance();
+			const Index cols = kernel.cols();
+			const Index block = block_cols(cols, pool.thread_count());
+			const size_t task_count = static_cast<size_t>((cols + block - 1) / block);
+
+			if (task_count < 2ull)
+			{
+				SequentialEngine::convolve(kernel, flux, out);
+				return;
+			}
+
+			// partial results of the tasks side by side,
+			// the first task writes directly to out.
+			// The buffer is allocated once per call,
+			// it is not thread_local since the tasks
+			// run in the threads of the pool
+			const Index flux_cols = flux.cols();
+			MatrixXd partial(kernel.rows(),
+				static_cast<Index>(task_count - 1ull) * flux_cols);
+			out.resize(kernel.rows(), flux_cols);
+
+			pool.parallel_for(task_count,
+				[&kernel, &flux, &out, &partial, cols, block, flux_cols](size_t task)
+				{
+					const Index begin = static_cast<Index>(task) * block;
+					const Index count = (std::min)(block, cols - begin);
+					if (task == 0ull)
+						KernelProduct::assign(
+							kernel.middleCols(begin, count),
+							flux.middleRows(begin, count),
+							out);
+					else
+						KernelProduct::assign(
+							kernel.middleCols(begin, count),
+							flux.middleRows(begin, count),
+							partial.middleCols(
+								static_cast<Index>(task - 1ull) * flux_cols, flux_cols));
+				});
+
+			// the order of summation is fixed,
+			// so the result does not depend on the scheduling
+			for (Index col = 0; col < partial.cols(); col += flux_cols)
+				out += partial.middleCols(col, flux_cols);
+		}
+	};
+
+	/**
+	 * @brief Chooses between row and column splitting
+	 * depending on the shape of the Kernel block.
+	 *
+	 * Rows are split when there are enough rows
+	 * to give every thread a block, since then
+	 * no reduction is required.
+	 * Otherwise the columns are split if the kernel is wide enough.
+	 */
+	struct AutoPartitionedEngine
+	{
+		template<typename KernelBlock, typename FluxBlock, typename Out>
+		static void convolve(
+			const KernelBlock& kernel,
+			const FluxBlock& flux,
+			Out& out)
+		{
+			const Index threads =
+				static_cast<Index>(ThreadPool::instance().thread_count());
+
+			if (kernel.rows() >= threads * RowPartitionedEngine::min_block_rows)
+				RowPartitionedEngine::convolve(kernel, flux, out);
+			else if (kernel.cols() >= 2 * ColumnPartitionedEngine::min_block_cols &&
+				kernel.cols() > kernel.rows())
+				ColumnPartitionedEngine::convolve(kernel, flux, out);
+			else
+				RowPartitionedEngine::convolve(kernel, flux, out);
+		}
+	};
+
+	/**
+	 * @brief The product of a kernel whose lag blocks
+	 * are nonzero within row bands, see KernelBands.
+	 * Every group of the bands is a dense block,
+	 * which is multiplied by the respective flux rows
+	 * into the respective rows of the result,
+	 * the rows beyond the bands are skipped.
+	 *
+	 * With POOL_CODE the rows of the result are split into blocks
+	 * as in RowPartitionedEngine, and every task multiplies
+	 * the parts of the groups within its rows.
+	 */
+	struct BandedEngine
+	{
+		/**
+		 * \param groups Groups of the bands of the kernel block,
+		 * see KernelBands::groups()
+		 */
+		template<typename KernelBlock, typename Groups, typename FluxBlock, typename Out>
+		static void convolve(
+			const KernelBlock& kernel,
+			const Groups& groups,
+			const FluxBlock& flux,
+			Out& out)
+		{
+			out.resize(kernel.rows(), flux.cols());
+			out.setZero();
+#ifdef POOL_CODE
+			ThreadPool& pool = ThreadPool::instance();
+			const Index rows = kernel.rows();
+			const Index block = RowPartitionedEngine::block_rows(rows, pool.thread_count());
+			const size_t task_count = static_cast<size_t>((rows + block - 1) / block);
+			if (task_count > 1ull)
+			{
+				pool.parallel_for(task_count,
+					[&kernel, &groups, &flux, &out, rows, block](size_t task)
+					{
+						const Index begin = static_cast<Index>(task) * block;
+						add(kernel, groups, flux, out,
+							begin, (std::min)(begin + block, rows));
+					});
+				return;
+			}
+#endif
+			add(kernel, groups, flux, out, 0, kernel.rows());
+		}
+
+		/**
+		 * \brief out += kernel * flux within the rows [row_begin; row_end)
+		 */
+		template<typename KernelBlock, typename Groups, typename FluxBlock, typename Out>
+		static void add(
+			const KernelBlock& kernel,
+			const Groups& groups,
+			const FluxBlock& flux,
+			Out&& out,
+			Index row_begin,
+			Index row_end)
+		{
+			for (const auto& group : groups)
+			{
+				const Index begin = (std::max)(group.row_begin, row_begin);
+				const Index end = (std::min)(group.row_begin + group.row_count, row_end);
+				if (begin >= end)
+					continue;
+				KernelProduct::add(
+					kernel.block(begin, group.col_begin, end - begin, group.col_count),
+					flux.middleRows(group.col_begin, group.col_count),
+					out.middleRows(begin, end - begin));
+			}
+		}
+	};
+
+#ifdef POOL_CODE
+	using DefaultConvolutionEngine = AutoPartitionedEngine;
+#else
+	using DefaultConvolutionEngine = SequentialEngine;
+#endif
+
+	/**
+	 * @brief Selects the engine for a regime.
+	 * Specialize it for a flux allocator
+	 * (FluxConstStep, FluxMainStep, FluxMixStep)
+	 * to change the engine of that regime only, e.g.,
+	 *
+	 * template<>
+	 * struct ConvolutionEngineSelector<FluxMixStep>
+	 * {
+	 *		using type = SequentialEngine;
+	 * };
+	 */
+	template<typename Allocator_t>
+	struct ConvolutionEngineSelector
+	{
+		using type = DefaultConvolutionEngine;
+	};
+
+	/**
+	 * @brief Convolves a window of a kernel by the engine
+	 * of the regime, or by BandedEngine if the kernel
+	 * is stored by row bands, see BaseKernel::enable_row_bands()
+	 *
+	 * \param col_begin Index of the first col of the window in the Kernel
+	 */
+	template<
+		typename Allocator_t, typename Kernel_t,
+		typename KernelBlock, typename FluxBlock, typename Out>
+	void convolve_window(
+		const Kernel_t& kernel,
+		const KernelBlock& window,
+		size_t col_begin,
+		const FluxBlock& flux,
+		Out& out)
+	{
+		if (kernel.is_banded())
+			BandedEngine::convolve(
+				window,
+				kernel.band_groups(col_begin, static_cast<size_t>(window.cols())),
+				flux, out);
+		else
+			ConvolutionEngineSelector<Allocator_t>::type::convolve(
+				window, flux, out);
+	}
+} // Convolution
@@ -0,0 +1,175 @@
+/*****************************************************************//**
+ * \file   FFT.h
+ * \brief  The file contains a self-contained radix-2 FFT
+ * used by the frequency-domain convolution engines.
+ *
+ * Real sequences are transformed in pairs:
+ * two real sequences of size N are packed
+ * into a single complex one, a + i*b,
+ * so a single complex FFT of size N gives both spectra.
+ * Only the bins [0; N/2] of a real sequence are stored,
+ * the others are complex conjugates.
+ *********************************************************************/
+
+#pragma once
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <vector>
+
+namespace Convolution
+{
+	class FFT
+	{
+	public:
+		using complex = std::complex<double>;
+
+		/**
+		 * \param size Nmbr of points, it must be a power of 2
+		 */
+		explicit FFT(size_t size) :
+			its_size{ size },
+			twiddles(size / 2),
+			bit_reversed(size),
+			work(size)
+		{
+			if (size < 2 || (size & (size - 1)) != 0)
+				throw std::runtime_error("FFT: the size must be a power of 2.");
+
+			const double pi = std::acos(-1.0);
+			for (size_t k = 0; k < size / 2; ++k)
+				twiddles[k] = std::polar(1.0,
+					-2.0 * pi * static_cast<double>(k) / static_cast<double>(size));
+
+			size_t log_size = 0;
+			while ((size_t{ 1 } << log_size) < size)
+				++log_size;
+			for (size_t k = 0; k < size; ++k)
+			{
+				size_t reversed = 0;
+				for (size_t bit = 0; bit < log_size; ++bit)
+					if (k & (size_t{ 1 } << bit))
+						reversed |= size_t{ 1 } << (log_size - 1 - bit);
+				bit_reversed[k] = reversed;
+			}
+		}
+
+		size_t size() const noexcept
+		{
+			return its_size;
+		}
+
+		/**
+		 * \brief Nmbr of bins stored for a real sequence
+		 */
+		size_t bins() const noexcept
+		{
+			return its_size / 2 + 1;
+		}
+
+		/**
+		 * \brief In-place transform,
+		 * X[k] = sum_n x[n] exp(-2*pi*i*k*n/N)
+		 */
+		void forward(complex* data) const
+		{
+			transform(data, false);
+		}
+
+		/**
+		 * \brief In-place inverse transform, scaled by 1/N
+		 */
+		void inverse(complex* data) const
+		{
+			transform(data, true);
+			const double scale = 1.0 / static_cast<double>(its_size);
+			for (size_t k = 0; k < its_size; ++k)
+				data[k] *= scale;
+		}
+
+		/**
+		 * \brief Spectra of two real sequences of size()
+		 * points, bins [0; size()/2] are written
+		 *
+		 * \param b The second sequence, it can be nullptr
+		 * \param B_spectrum It is not written if b is nullptr
+		 */
+		void forward_real(
+			const double* a, const double* b,
+			complex* A_spectrum, complex* B_spectrum)
+		{
+			for (size_t k = 0; k < its_size; ++k)
+				work[k] = complex{ a[k], b ? b[k] : 0.0 };
+			forward(work.data());
+
+			for (size_t k = 0; k < bins(); ++k)
+			{
+				const complex z = work[k];
+				const complex z_mirror = std::conj(work[(its_size - k) % its_size]);
+				A_spectrum[k] = 0.5 * (z + z_mirror);
+				if (b)
+					B_spectrum[k] = complex{ 0.0, -0.5 } * (z - z_mirror);
+			}
+		}
+
+		/**
+		 * \brief Two real sequences from their spectra,
+		 * it is the inverse of forward_real()
+		 *
+		 * \param B_spectrum The second spectrum, it can be nullptr
+		 * \param b It is not written if B_spectrum is nullptr
+		 */
+		void inverse_real(
+			const complex* A_spectrum, const complex* B_spectrum,
+			double* a, double* b)
+		{
+			const complex i{ 0.0, 1.0 };
+			for (size_t k = 0; k < bins(); ++k)
+				work[k] = A_spectrum[k] +
+					(B_spectrum ? i * B_spectrum[k] : complex{});
+			for (size_t k = bins(); k < its_size; ++k)
+				work[k] = std::conj(A_spectrum[its_size - k]) +
+					(B_spectrum ? i * std::conj(B_spectrum[its_size - k]) : complex{});
+			inverse(work.data());
+
+			for (size_t k = 0; k < its_size; ++k)
+			{
+				a[k] = work[k].real();
+				if (B_spectrum)
+					b[k] = work[k].imag();
+			}
+		}
+
+	private:
+		void transform(complex* data, bool is_inverse) const
+		{
+			for (size_t k = 0; k < its_size; ++k)
+				if (k < bit_reversed[k])
+					std::swap(data[k], data[bit_reversed[k]]);
+
+			for (size_t half = 1; half < its_size; half *= 2)
+			{
+				const size_t stride = its_size / (2 * half);
+				for (size_t start = 0; start < its_size; start += 2 * half)
+					for (size_t k = 0; k < half; ++k)
+					{
+						const complex w = is_inverse ?
+							std::conj(twiddles[k * stride]) :
+							twiddles[k * stride];
+						const complex odd = w * data[start + k + half];
+						data[start + k + half] = data[start + k] - odd;
+						data[start + k] += odd;
+					}
+			}
+		}
+
+	private:
+		const size_t its_size;
+		// exp(-2*pi*i*k/N), k < N/2
+		std::vector<complex> twiddles;
+		std::vector<size_t> bit_reversed;
+		// buffer for the packed real sequences
+		std::vector<complex> work;
+	};
+} // Convolution
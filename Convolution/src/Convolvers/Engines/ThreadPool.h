@@ -0,0 +1,266 @@
+/*****************************************************************//**
+ * \file   ThreadPool.h
+ * \brief  The file contains a persistent pool of worker threads
+ * shared by all kernels and fluxes.
+ *
+ * The threads are created once (on the first request)
+ * and are kept asleep between convolutions,
+ * so there is no thread creation cost per time step.
+ *
+ * The number of threads is taken from the
+ * CONVOLUTION_NUM_THREADS environment variable,
+ * or from std::thread::hardware_concurrency(),
+ * and can be changed at runtime with set_thread_count().
+ *********************************************************************/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Convolution
+{
+	/**
+	 * @brief Persistent pool of threads.
+	 *
+	 * A job is a set of independent tasks [0; task_count),
+	 * the tasks are taken by workers (and by the calling thread)
+	 * through an atomic counter, so a slow task does not
+	 * block the others.
+	 *
+	 * parallel_for() is blocking and is serialized:
+	 * only one job is processed at a time.
+	 * A worker copies the job under the mutex when it joins it,
+	 * and parallel_for() returns once every worker
+	 * which joined the job has left it, so no worker
+	 * takes the tasks of a finished job.
+	 * A parallel_for() called from inside a task
+	 * is executed sequentially by the calling worker.
+	 */
+	class ThreadPool
+	{
+	public:
+		/**
+		 * @brief The pool shared by all convolution engines
+		 */
+		static ThreadPool& instance()
+		{
+			static ThreadPool pool{ default_thread_count() };
+			return pool;
+		}
+
+		explicit ThreadPool(size_t thread_count) :
+			job{},
+			job_generation{ 0ull },
+			job_open{ false },
+			active_workers{ 0ull },
+			next_task{ 0ull },
+			stop{ false }
+		{
+			start_workers(thread_count);
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		~ThreadPool()
+		{
+			stop_workers();
+		}
+
+		/**
+		 * \brief Total number of threads which take part in a job,
+		 * including the calling thread
+		 */
+		size_t thread_count() const noexcept
+		{
+			return workers.size() + 1ull;
+		}
+
+		/**
+		 * \brief Recreates the workers with a new number of threads.
+		 * It must not be called while a job is in progress.
+		 *
+		 * \param thread_count Total number of threads,
+		 * including the calling thread. Zero is treated as one.
+		 */
+		void set_thread_count(size_t thread_count)
+		{
+			std::lock_guard<std::mutex> job_lock{ job_mutex };
+			stop_workers();
+			start_workers(thread_count);
+		}
+
+		/**
+		 * \brief Executes task(idx) for every idx in [0; task_count)
+		 * and returns when all the tasks are done.
+		 *
+		 * \param task_count Number of independent tasks
+		 * \param task Callable with the signature void(size_t)
+		 */
+		template<typename Task>
+		void parallel_for(size_t task_count, const Task& task)
+		{
+			if (task_count == 0ull)
+				return;
+
+			if (task_count == 1ull || workers.empty() || is_worker_thread())
+			{
+				for (size_t idx = 0; idx < task_count; ++idx)
+					task(idx);
+				return;
+			}
+
+			std::lock_guard<std::mutex> job_lock{ job_mutex };
+			const Job current{ &invoke<Task>, &task, task_count };
+			{
+				// the workers of the previous job have left it,
+				// a worker reads the job and next_task
+				// only after it has locked the mutex
+				std::lock_guard<std::mutex> lock{ mutex };
+				job = current;
+				next_task.store(0ull, std::memory_order_relaxed);
+				job_open = true;
+				++job_generation;
+			}
+			wake_up.notify_all();
+
+			// the calling thread works as well
+			run_tasks(current);
+
+			// all the tasks are taken, the ones left
+			// are done by the workers which joined the job
+			std::unique_lock<std::mutex> lock{ mutex };
+			job_done.wait(lock, [this]() { return active_workers == 0ull; });
+			job_open = false;
+			job = Job{};
+		}
+
+	private:
+		/**
+		 * @brief Description of a job, a worker copies it
+		 * under the mutex when it joins the job
+		 */
+		struct Job
+		{
+			void (*invoke)(const void*, size_t){ nullptr };
+			const void* context{ nullptr };
+			size_t task_count{ 0ull };
+		};
+
+		template<typename Task>
+		static void invoke(const void* context, size_t idx)
+		{
+			(*static_cast<const Task*>(context))(idx);
+		}
+
+		static size_t default_thread_count()
+		{
+			if (const char* env = std::getenv("CONVOLUTION_NUM_THREADS"))
+			{
+				size_t count = std::strtoull(env, nullptr, 10);
+				if (count > 0ull)
+					return count;
+			}
+			size_t count = std::thread::hardware_concurrency();
+			return count > 0ull ? count : 1ull;
+		}
+
+		static bool& is_worker_thread()
+		{
+			thread_local bool flag{ false };
+			return flag;
+		}
+
+		void start_workers(size_t thread_count)
+		{
+			stop = false;
+			// the calling thread is the last one
+			size_t worker_count = thread_count > 1ull ? thread_count - 1ull : 0ull;
+			workers.reserve(worker_count);
+			for (size_t id = 0; id < worker_count; ++id)
+				workers.emplace_back([this]() { worker_loop(); });
+		}
+
+		void stop_workers()
+		{
+			{
+				std::lock_guard<std::mutex> lock{ mutex };
+				stop = true;
+			}
+			wake_up.notify_all();
+			for (auto& worker : workers)
+				worker.join();
+			workers.clear();
+		}
+
+		void worker_loop()
+		{
+			is_worker_thread() = true;
+			size_t seen_generation = 0ull;
+			{
+				std::lock_guard<std::mutex> lock{ mutex };
+				seen_generation = job_generation;
+			}
+			for (;;)
+			{
+				Job current;
+				{
+					std::unique_lock<std::mutex> lock{ mutex };
+					// a worker which wakes up after the job is closed
+					// waits for the next one
+					wake_up.wait(lock, [this, seen_generation]() {
+						return stop || (job_open && job_generation != seen_generation); });
+					if (stop)
+						return;
+					seen_generation = job_generation;
+					current = job;
+					++active_workers;
+				}
+				run_tasks(current);
+				{
+					std::lock_guard<std::mutex> lock{ mutex };
+					if (--active_workers == 0ull)
+						job_done.notify_one();
+				}
+			}
+		}
+
+		/**
+		 * \brief Takes tasks of the job until none is left
+		 */
+		void run_tasks(const Job& current)
+		{
+			for (;;)
+			{
+				size_t idx = next_task.fetch_add(1ull, std::memory_order_relaxed);
+				if (idx >= current.task_count)
+					break;
+				current.invoke(current.context, idx);
+			}
+		}
+
+	private:
+		std::vector<std::thread> workers;
+
+		// serializes the jobs of concurrent callers
+		std::mutex job_mutex;
+		// guards the job description, the nmbr of workers
+		// in the job and the stop flag
+		std::mutex mutex;
+		std::condition_variable wake_up;
+		std::condition_variable job_done;
+
+		Job job;
+		size_t job_generation;
+		// the workers join the job while it is open
+		bool job_open;
+		size_t active_workers;
+
+		std::atomic<size_t> next_task;
+		bool stop;
+	};
+} // Convolution
@@ -3,25 +3,21 @@
 #include <Eigen/Dense>
 #include <Eigen/Core>
 #include <array>
+#include <vector>
 
 #include "../ConvolutionDefines.h"
 #include "../Kernels/BaseKernel.h"
+#include "../Kernels/CumulativeKernel.h"
+#include "FluxStorage.h"
 
-#undef OMPH_CODE			// use parallel version with openMP
-
-#ifndef PPL_CODE    // parallel code, using ppl
-#ifndef OMPH_CODE   // parallel code, using openMP
-#define SEQUEN_CODE // sequential code, MatrixXd*VectorXd is not done in parallel
-#endif
-#endif
-
-
+// the parallel code is chosen in ConvolutionDefines.h
 #ifdef OMPH_CODE
 #include <omp.h>
 #endif
 #ifdef PPL_CODE
 #include <ppl.h>
 #endif
+#include "../Engines/ConvolutionEngine.h"
 
 namespace Convolution
 {
@@ -114,15 +110,30 @@ namespace Convolution
 	class BaseFluxContainer : public CommonBase<Allocator_t>
 	{
 	protected:
-		// a ColumnMajor vector of Nwell*Nt(rows) by 1(cols) elements
-		VectorXd flux;
+		// a ColumnMajor vector of Nwell*Nt(rows) by 1(cols) elements,
+		// or a ring of Nwell*frame_temporal_size elements
+		// for FluxRingStep
+		typename FluxStorage<Allocator_t>::type flux;
+		// the convolution of all the lags except the newest one,
+		// it is computed once per time step by convolve_history()
+		VectorXd history_convolved;
+		// the last result of convolve_current()
+		VectorXd current_convolved;
+		// the flux differences of convolve_by_parts()
+		// and the runs of the lags where they are nonzero,
+		// reused by every call
+		mutable VectorXd parts_delta;
+		mutable std::vector<BandedBlock> parts_runs;
 
 	public:
+		// result of convolution with a kernel
+		using result_type = VectorXd;
+
 		BaseFluxContainer(
 			const typename KernelTypedefs<Allocator_t>::Allocator& 
 			convDesc) :
 				CommonBase<Allocator_t>{ convDesc },
-				flux{ VectorXd::Zero(convDesc.pusher.allocated_memory()) }
+				flux{ FluxStorage<Allocator_t>::create(convDesc) }
 		{
 #ifdef OMPH_CODE
 			// check whether the threads have already been created 
@@ -162,22 +173,58 @@ namespace Convolution
 				rows());
 		}
 
+		/**
+		 * \brief Returns the window of the flux-data
+		 * pushed the given nmbr of time frames earlier,
+		 * see InterpolatedFluxContainerMainStep.
+		 *
+		 * The frames older than the first pushed one
+		 * are not stored, so the window is shorter than rows()
+		 * by these frames.
+		 */
+		auto earlier_window(size_t frames) const
+		{
+			const size_t shift = frames * allocator.extractor.spatial_size();
+			const size_t begin = (std::min)(
+				allocator.extractor.idx_begin() + shift,
+				static_cast<size_t>(flux.size()));
+			const size_t end = (std::min)(
+				allocator.extractor.idx_end() + shift,
+				static_cast<size_t>(flux.size()));
+			return flux.segment(begin, end - begin);
+		}
+
 		/**
 		 * \brief Method to convolve the BaseKernel
 		 * with the BaseFluxContainer column for all the mesh points at once
 		 *
 		 * \return Result of convolution for all mesh points
 		 */
-		template<typename KernelAllocator_t>
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
 		VectorXd convolve(
-			const BaseKernel<KernelAllocator_t>& kernel) const
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel) const
+		{
+			VectorXd out;
+			convolve_into(kernel, out);
+			return out;
+		}
+
+		/**
+		 * \brief Same as convolve(), the result is written to out.
+		 * The memory of out is reused if it has the proper size,
+		 * so no memory is allocated once the time stepping is warmed up.
+		 */
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
+		void convolve_into(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel,
+			VectorXd& out) const
 		{
 #ifdef OMPH_CODE
 			////////////////////////////////////////////////////openMP version
 			// nmbr of rows in the matrix/Kernel
 			size_t rows = kernel.rows();
 			// memory allocation for the result of convolution
-			VectorXd out{ rows };
+			out.resize(rows);
 			// total nmbr of available threads
 			// created in advance, once and for all
 			size_t real_thread_count = omp_get_num_threads(); // omp_get_num_procs();
@@ -197,14 +244,16 @@ namespace Convolution
 				out.segment(idx * g, count) =
 					kernel().middleRows(idx * g, count) * (*this)();
 			}
-
-			return out;
 #else
-#ifdef SEQUEN_CODE
-			return //VectorXd::Ones(kernel.rows());
-				kernel()
-				//		MatrixXd::Ones(kernel.rows(), kernel.cols()) 
-				* (*this)();
+#if defined(SEQUEN_CODE) || defined(POOL_CODE)
+			// the engine is chosen per regime,
+			// see ConvolutionEngineSelector
+			// the kernel window is shorter than the flux one
+			// once the kernel reaches an adaptive external boundary
+			const auto window = kernel();
+			convolve_window<Allocator_t>(
+				kernel, window, kernel.window_begin(),
+				(*this)().head(window.cols()), out);
 #else
 #ifdef PPL_CODE
 			std::static_assert("IMPLEMENT CONVOLUTION USING PPL LIBRARY");
@@ -215,6 +264,210 @@ namespace Convolution
 #endif
 		}
 
+		/**
+		 * \brief kernel.advance() fused with convolve_into().
+		 *
+		 * The new lag block F*(P_cur - P_prev) multiplies
+		 * the oldest flux of the window. It is computed by row tiles,
+		 * and every tile is multiplied by that flux and
+		 * added to the product of the history lags of its rows
+		 * while it is in the cache, so the new block
+		 * is written to the memory once and it is not read back.
+		 * The rows are split between the threads as in RowPartitionedEngine.
+		 *
+		 * The flux of the current time step must be pushed
+		 * and extracted, e.g., flux.extract().advance_convolve_into(kernel, out).
+		 * If the kernel cannot be fused, see BaseKernel::can_fuse_advance(),
+		 * it is advanced and convolved as usual.
+		 *
+		 * \param kernel Kernel whose P_cur is filled in
+		 */
+		template<typename Kernel_t>
+		void advance_convolve_into(
+			Kernel_t& kernel,
+			VectorXd& out) const
+		{
+			const Index new_col = static_cast<Index>(kernel.block_stride_in_row());
+			const Index width = static_cast<Index>(kernel.block_width());
+			const auto window = (*this)();
+			if (!kernel.can_fuse_advance() || window.size() < new_col + width)
+			{
+				kernel.advance();
+				convolve_into(kernel, out);
+				return;
+			}
+
+			const Index rows = static_cast<Index>(kernel.rows());
+			out.resize(rows);
+			auto tiles = [&kernel, &window, &out, new_col, width](
+				Index row_begin, Index row_end)
+			{
+				for (Index row = row_begin; row < row_end; row += KernelProduct::tile_rows)
+				{
+					const Index count = (std::min)(KernelProduct::tile_rows, row_end - row);
+					const auto block = kernel.store_block_rows(row, count);
+					auto result = out.segment(row, count);
+					result.noalias() =
+						kernel.Kernel.block(row, 0, count, new_col) * window.head(new_col);
+					result.noalias() += block * window.segment(new_col, width);
+				}
+			};
+#ifdef POOL_CODE
+			ThreadPool& pool = ThreadPool::instance();
+			const Index block = RowPartitionedEngine::block_rows(rows, pool.thread_count());
+			pool.parallel_for(static_cast<size_t>((rows + block - 1) / block),
+				[&tiles, rows, block](size_t task)
+				{
+					const Index begin = static_cast<Index>(task) * block;
+					tiles(begin, (std::min)(begin + block, rows));
+				});
+#else
+			tiles(0, rows);
+#endif
+			kernel.commit_advance();
+			// the window of the kernel ends with the new block
+			kernel.allocator.extractor.on_extract();
+		}
+
+		/**
+		 * \brief Convolution by parts with a CumulativeKernel,
+		 * whose column block l is C_l = K_0 + ... + K_l,
+		 * i.e., P at the lag l+1 minus the initial P
+		 * in the reflection regime (F == 1):
+		 *		sum_l K_l q_l = sum_l C_l (q_l - q_{l+1}),
+		 * where q_l is the flux at the lag l and q_L = 0
+		 * beyond the window of L lags.
+		 *
+		 * Only the lags where the flux changed are multiplied,
+		 * so the periods of a constant rate cost nothing.
+		 * The result is the one of convolve() with the lag kernel.
+		 *
+		 * \return Result of convolution for all mesh points
+		 */
+		template<
+			template<typename> typename Kernel_t,
+			typename KernelAllocator_t>
+		VectorXd convolve_by_parts(
+			const CumulativeKernel<Kernel_t, KernelAllocator_t>& kernel) const
+		{
+			const auto window = kernel();
+			const Index width = static_cast<Index>(
+				allocator.extractor.spatial_size());
+			const Index cols = window.cols();
+			// no lag is in the window yet
+			if (cols < width)
+				return VectorXd::Zero(window.rows());
+			const auto data = (*this)().head(cols);
+
+			parts_delta.resize(cols);
+			parts_delta.head(cols - width) =
+				data.head(cols - width) - data.segment(width, cols - width);
+			parts_delta.tail(width) = data.tail(width);
+
+			// the runs of the lags with a nonzero delta
+			parts_runs.clear();
+			for (Index col = 0; col < cols; col += width)
+			{
+				if ((parts_delta.segment(col, width).array() == 0.0).all())
+					continue;
+				if (!parts_runs.empty() &&
+					parts_runs.back().col_begin + parts_runs.back().col_count == col)
+					parts_runs.back().col_count += width;
+				else
+					parts_runs.push_back(BandedBlock{ col, width, 0, window.rows() });
+			}
+
+			VectorXd out;
+			BandedEngine::convolve(window, parts_runs, parts_delta, out);
+
+			// the window does not start at the first lag,
+			// so its first block is C_b - C_{b-1}
+			const Index window_begin = static_cast<Index>(kernel.window_begin());
+			if (window_begin > 0)
+				KernelProduct::add(
+					kernel.Kernel.middleCols(window_begin - width, width),
+					-data.head(width),
+					out);
+			return out;
+		}
+
+		/**
+		 * \brief Convolves all the lags except the newest one
+		 * and caches the result.
+		 *
+		 * It replaces convolve() at the first Newton iteration
+		 * of a time step: the kernel window is extracted here,
+		 * once per time step. The flux of the current time step
+		 * must be already pushed (e.g., an initial guess),
+		 * its value is not used, and extract() must be called
+		 * before, as a separate statement: extract() returns
+		 * a const reference, and this method is not const.
+		 *
+		 * \return History part of the convolution for all mesh points
+		 */
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
+		const VectorXd& convolve_history(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel)
+		{
+			auto window = kernel();
+			const Index newest = static_cast<Index>(
+				allocator.extractor.spatial_size());
+			const Index older = window.cols() - newest;
+
+			if (older > 0)
+				convolve_window<Allocator_t>(
+					kernel, window.rightCols(older),
+					kernel.window_begin() + static_cast<size_t>(newest),
+					(*this)().segment(newest, older),
+					history_convolved);
+			else
+				history_convolved = VectorXd::Zero(window.rows());
+			return history_convolved;
+		}
+
+		/**
+		 * \brief Convolution at a Newton iteration.
+		 * The trial flux replaces the flux of the current time step
+		 * and only the newest lag block of the kernel,
+		 * kernel.jacobian(), is applied to it.
+		 * The history part is taken from convolve_history().
+		 *
+		 * \param trial Flux of the current time step in the form
+		 * it is stored, e.g., calc_coef(cur_qzi, perm) for wells
+		 * \return Result of convolution for all mesh points
+		 */
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t, typename T>
+		const VectorXd& convolve_current(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel,
+			const T& trial)
+		{
+			auto newest = flux.segment(
+				allocator.extractor.idx_begin(),
+				allocator.extractor.spatial_size());
+			newest = trial;
+
+			current_convolved = history_convolved;
+			if (kernel.is_banded())
+				BandedEngine::add(
+					kernel.jacobian(),
+					kernel.band_groups(kernel.window_begin(), kernel.block_width()),
+					newest, current_convolved,
+					0, current_convolved.rows());
+			else
+				KernelProduct::add(kernel.jacobian(), newest, current_convolved);
+			return current_convolved;
+		}
+
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			visitor.pod(allocator);
+			auto memory = flux.segment(0, static_cast<size_t>(flux.size()));
+			visitor.region(
+				memory.data(),
+				static_cast<size_t>(memory.size()) * sizeof(double));
+		}
+
 		const BaseFluxContainer<Allocator_t>& extract() const
 		{
 			CommonBase<Allocator_t>::
@@ -16,6 +16,8 @@ namespace Convolution
 	struct BaseFluxContainerMainStep :
 		public FluxTypedefs<Allocator_t>
 	{
+		using result_type = typename Flux_t<Allocator_t>::result_type;
+
 		/**
 		 * @brief ctor
 		 */
@@ -26,7 +28,7 @@ namespace Convolution
 			main_step_nmbr{ convDesc.main_step_nmbr },
 			// a flux of all zeros is required initially 
 			// for the averaging
-			prev_flux{ ArrayXd::Zero(convDesc.pusher.allocated_memory()) }, 
+			prev_flux{ ArrayXd::Zero(convDesc.pusher.spatial_size()) }, 
 			flux_set
 		{
 			std::vector<Flux_t<Allocator_t>>(
@@ -132,6 +134,61 @@ namespace Convolution
 			return (*flux_ptr);
 		}
 
+		/**
+		 * \brief Takes the fluxes of all the small steps
+		 * of the next main step at once.
+		 * It replaces small_step_nmbr calls of extract()
+		 * in the second part of the history.
+		 *
+		 * \return Matrix of the flux windows,
+		 * the column i corresponds to the small step i
+		 */
+		const MatrixXd& extract_main_step()
+		{
+			assert(main_step_counter >= main_step_nmbr);
+			// the batch must start at the first small step
+			assert(cur_container_id == small_step_nmbr - 1);
+
+			for (size_t step_id = 0; step_id < small_step_nmbr; ++step_id)
+			{
+				switch_fluxContainer();
+				auto window = (*flux_ptr)();
+				if (step_id == 0)
+					main_step_flux.resize(window.size(), small_step_nmbr);
+				main_step_flux.col(step_id) = window;
+			}
+			return main_step_flux;
+		}
+
+		/**
+		 * \brief Convolves the kernel with the fluxes
+		 * taken by extract_main_step() as a single
+		 * matrix-matrix product.
+		 *
+		 * The kernel window does not move within
+		 * a main step, so it is read from memory once
+		 * instead of small_step_nmbr times.
+		 * The kernel is extracted small_step_nmbr times,
+		 * as it would be by the small step convolutions.
+		 *
+		 * \return Matrix of size (kernel.rows(); small_step_nmbr),
+		 * the column i is the result for the small step i
+		 */
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
+		MatrixXd convolve_main_step(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel) const
+		{
+			auto window = kernel();
+			const size_t window_begin = kernel.window_begin();
+			for (size_t step_id = 1; step_id < small_step_nmbr; ++step_id)
+				kernel.allocator.extractor.on_extract();
+
+			MatrixXd out;
+			convolve_window<Allocator_t>(
+				kernel, window, window_begin, main_step_flux, out);
+			return out;
+		}
+
 		double operator()(size_t nt, size_t segm_id) const
 		{
 			if (nt - 1 < main_step_nmbr)
@@ -145,6 +202,18 @@ namespace Convolution
 			}
 		}
 
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			for (auto& flux : flux_set)
+				visitor.object(flux);
+			visitor.pod(main_step_counter);
+			visitor.pod(cur_container_id);
+			visitor.array(prev_flux);
+			// the pointer is not stored
+			flux_ptr = &flux_set[cur_container_id];
+		}
+
 	protected:
 		std::vector<Flux_t<Allocator_t>> flux_set;
 		Flux_t<Allocator_t>* flux_ptr;
@@ -157,6 +226,10 @@ namespace Convolution
 		const size_t main_step_nmbr;
 
 		ArrayXd prev_flux;
+
+		// flux windows of all the small steps
+		// of a main step, see extract_main_step()
+		MatrixXd main_step_flux;
 	};
 
 	template<typename Allocator_t>
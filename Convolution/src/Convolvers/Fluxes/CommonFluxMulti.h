@@ -22,6 +22,12 @@ namespace Convolution
 	* BaseFracFluxMainStep,
 	*		or 
 	* BaseFracFlux 
+	* 
+	*		OR
+	* 
+	* EnsembleWellFlux, EnsembleFracFlux,
+	* then the results are matrices
+	* with a column per scenario
 	*/
 	template<
 		typename Allocator_t,
@@ -33,19 +39,28 @@ namespace Convolution
 		using container_type = 
 			std::array<kernel_type, array_size>;
 
+		using result_type =
+			typename Flux_t<Allocator_t>::result_type;
+
 	protected:
-		std::array<VectorXd, array_size> 
+		std::array<result_type, array_size> 
 			convolved_data_vector;
+		std::array<MatrixXd, array_size>
+			convolved_main_step_vector;
 
 	public:
 		// This is a general purpose ctor.
+		// Args are passed to Flux_t, e.g.,
+		// the number of scenarios of an ensemble flux
+		template<typename... Args>
 		CommonFluxMulti(
-			const typename Flux_t<Allocator_t>::Allocator& convDesc) :
-			Flux_t<Allocator_t>{ convDesc }
+			const typename Flux_t<Allocator_t>::Allocator& convDesc,
+			const Args&... args) :
+			Flux_t<Allocator_t>{ convDesc, args... }
 		{}
 
 		template<typename kernel_type>
-		const std::array<VectorXd, array_size>& convolve(
+		const std::array<result_type, array_size>& convolve(
 			const container_type<kernel_type>& kernels)
 		{
 			// data() method calls the 
@@ -61,15 +76,47 @@ namespace Convolution
 				// using data() we take an appropriate flux set
 				// for convolution of MainStep terms at various 
 				// small steps.
-				convolved_data_vector[id] = 
-					data.convolve(kernels[id]);
+				// the results of the previous time step
+				// are overwritten in place
+				data.convolve_into(kernels[id], convolved_data_vector[id]);
 			}
 			return convolved_data_vector;
 		}
 
-		double result(size_t idx, size_t data_id)
+		/**
+		 * \brief Convolves the kernels with the fluxes
+		 * of all the small steps of the next main step.
+		 * It is available in the second part of the history
+		 * for the MainStep fluxes, and replaces
+		 * small_step_nmbr calls of convolve().
+		 *
+		 * \return For every kernel, a matrix whose column i
+		 * is the result for the small step i
+		 */
+		template<typename kernel_type>
+		const std::array<MatrixXd, array_size>& convolve_main_step(
+			const container_type<kernel_type>& kernels)
+		{
+			// the fluxes are taken once for all kernels
+			Flux_t<Allocator_t>::extract_main_step();
+			for (size_t id = 0; id < array_size; ++id)
+			{
+				convolved_main_step_vector[id] =
+					Flux_t<Allocator_t>::convolve_main_step(kernels[id]);
+			}
+			return convolved_main_step_vector;
+		}
+
+		/**
+		 * \brief The result of the kernel data_id at the mesh point idx.
+		 * For an ensemble flux the result is a matrix,
+		 * and scenario_id is its column
+		 */
+		double result(size_t idx, size_t data_id, size_t scenario_id = 0) const
 		{
-			return (*this)[data_id][idx];
+			return (*this)[data_id](
+				static_cast<Index>(idx),
+				static_cast<Index>(scenario_id));
 		}
 
 		constexpr size_t size() const
@@ -77,12 +124,16 @@ namespace Convolution
 			return array_size;
 		}
 
+		/**
+		 * \brief Nmbr of mesh points of the result of the kernel id,
+		 * the nmbr of scenarios is not counted
+		 */
 		size_t size(size_t id) const
 		{
-			return convolved_data_vector[id].size();
+			return static_cast<size_t>(convolved_data_vector[id].rows());
 		}
 
-		const VectorXd& operator[](size_t data_id) const
+		const result_type& operator[](size_t data_id) const
 		{
 			return convolved_data_vector[data_id];
 		}
@@ -0,0 +1,262 @@
+#pragma once
+#include <Eigen/Dense>
+#include <Eigen/Core>
+
+#include "BaseFluxContainer.h"
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * \brief Container to store the flux data
+	 * of several scenarios (rate schedules) which are
+	 * convolved with the same Kernel.
+	 *
+	 * The histories are the columns of a matrix,
+	 * they share the allocator, i.e., every push
+	 * adds a time frame to all the scenarios.
+	 * So, the convolution of all the scenarios
+	 * is a single matrix-matrix product.
+	 *
+	 * The scenarios can be added and removed at runtime.
+	 */
+	template<typename Allocator_t>
+	class BaseEnsembleFlux : public CommonBase<Allocator_t>
+	{
+	protected:
+		// a ColumnMajor matrix of Nwell*Nt(rows) by scenario_count(cols) elements
+		MatrixXd flux;
+
+	public:
+		using result_type = MatrixXd;
+
+		BaseEnsembleFlux(
+			const typename KernelTypedefs<Allocator_t>::Allocator&
+			convDesc,
+			size_t scenario_count = 1ull) :
+			CommonBase<Allocator_t>{ convDesc },
+			flux{ MatrixXd::Zero(
+				convDesc.pusher.allocated_memory(),
+				scenario_count) }
+		{}
+
+		/**
+		 * \brief The number of scenarios, i.e.,
+		 * the number of cols in the flux data
+		 */
+		size_t cols() const
+		{
+			return static_cast<size_t>(flux.cols());
+		}
+
+		size_t scenario_count() const
+		{
+			return cols();
+		}
+
+		/**
+		 * \brief Returns the flux-data of a scenario
+		 * for a linear source term
+		 * which is associated with a segment and a time frame.
+		 *
+		 * \param nt time frame for the flux data
+		 * \param segm_id segment of the linear source term associated with the flux-data
+		 * \param scenario_id scenario of the flux-data
+		 */
+		double operator()(size_t nt, size_t segm_id, size_t scenario_id) const
+		{
+			return flux(
+				segm_id + flux.rows() - nt * allocator.extractor.spatial_size(),
+				scenario_id);
+		}
+
+		/**
+		 * \brief Returns the entire flux data
+		 * already pushed to the container for all the scenarios.
+		 * It is an Eigen::Block of size (rows; cols)
+		 */
+		auto operator()() const
+		{
+			return flux.middleRows(
+				allocator.extractor.idx_begin(),
+				rows());
+		}
+
+		/**
+		 * \brief Method to convolve the BaseKernel
+		 * with all the scenarios at once
+		 *
+		 * \return Result of convolution, a matrix of size
+		 * (mesh points; scenario_count), the column i is the
+		 * result for the scenario i
+		 */
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
+		MatrixXd convolve(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel) const
+		{
+			MatrixXd out;
+			convolve_into(kernel, out);
+			return out;
+		}
+
+		/**
+		 * \brief Same as convolve(), the memory of out is reused
+		 */
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
+		void convolve_into(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel,
+			MatrixXd& out) const
+		{
+			const auto window = kernel();
+			convolve_window<Allocator_t>(
+				kernel, window, kernel.window_begin(),
+				(*this)().topRows(window.cols()), out);
+		}
+
+		/**
+		 * \brief The restored container must have
+		 * the same nmbr of scenarios
+		 */
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			visitor.pod(allocator);
+			visitor.array(flux);
+		}
+
+		const BaseEnsembleFlux<Allocator_t>& extract() const
+		{
+			CommonBase<Allocator_t>::
+				on_extract();
+			return *this;
+		}
+
+		/**
+		 * \brief Pushes a time frame for all the scenarios
+		 *
+		 * \param data Block of size (spatial_size; scenario_count)
+		 */
+		template<typename T>
+		void push_coef(const T& data)
+		{
+			on_push();
+			flux.middleRows(
+				allocator.pusher.idx_begin(),
+				allocator.pusher.spatial_size()) = data;
+		}
+
+		/**
+		 * \brief Adds a scenario with a zero history
+		 *
+		 * \return Id of the new scenario
+		 */
+		size_t add_scenario()
+		{
+			Index id = flux.cols();
+			flux.conservativeResize(NoChange, id + 1);
+			flux.col(id).setZero();
+			return static_cast<size_t>(id);
+		}
+
+		/**
+		 * \brief Adds a scenario whose history is
+		 * the history of an existing scenario,
+		 * e.g., to branch a what-if forecast from the common past
+		 *
+		 * \param source_id Scenario to be copied
+		 * \return Id of the new scenario
+		 */
+		size_t add_scenario(size_t source_id)
+		{
+			assert(source_id < scenario_count());
+			Index id = flux.cols();
+			flux.conservativeResize(NoChange, id + 1);
+			flux.col(id) = flux.col(static_cast<Index>(source_id));
+			return static_cast<size_t>(id);
+		}
+
+		/**
+		 * \brief Removes a scenario.
+		 * The ids of the next scenarios are decreased by one.
+		 */
+		void remove_scenario(size_t scenario_id)
+		{
+			assert(scenario_id < scenario_count());
+			Index id = static_cast<Index>(scenario_id);
+			Index tail = flux.cols() - id - 1;
+			if (tail > 0)
+				flux.middleCols(id, tail) = flux.rightCols(tail).eval();
+			flux.conservativeResize(NoChange, flux.cols() - 1);
+		}
+	};
+
+	/**
+	 * @brief Provides the logic of data addition to the
+	 * ensemble of well fluxes, where the flux-log of every scenario
+	 * is divided by the permeability-log.
+	 */
+	template<typename Allocator_t>
+	class EnsembleWellFlux :
+		public BaseEnsembleFlux<Allocator_t>
+	{
+	public:
+		using BaseEnsembleFlux<Allocator_t>::BaseEnsembleFlux;
+		using BaseEnsembleFlux<Allocator_t>::push_coef;
+
+		/**
+		 * \brief Method pushes the qzi/permeability ratio
+		 * of every scenario at a new time moment
+		 *
+		 * \param cur_qzi Array of scenario_count() pointers to qzi-data
+		 * \param perm Pointer to the permeability-data
+		 */
+		void push_coef(const double* const* cur_qzi, const double* perm)
+		{
+			on_push();
+			const Index spatial_size = allocator.pusher.spatial_size();
+			auto frame = flux.middleRows(
+				allocator.pusher.idx_begin(), spatial_size);
+			for (Index id = 0; id < flux.cols(); ++id)
+			{
+				frame.col(id) = (
+					ArrayXd::Map(cur_qzi[id], spatial_size) /
+					ArrayXd::Map(perm, spatial_size)).matrix();
+			}
+		}
+	};
+
+	/**
+	 * @brief Provides the logic of data addition to the
+	 * ensemble of fracture fluxes, where qzf of every scenario
+	 * is divided by per*hf.
+	 */
+	template<typename Allocator_t>
+	class EnsembleFracFlux :
+		public BaseEnsembleFlux<Allocator_t>
+	{
+	public:
+		using BaseEnsembleFlux<Allocator_t>::BaseEnsembleFlux;
+		using BaseEnsembleFlux<Allocator_t>::push_coef;
+
+		/**
+		 * \brief Method pushes the qzf/(permeability*hf) ratio
+		 * of every scenario at a new time moment
+		 *
+		 * \param cur_qzf Array of scenario_count() pointers to qzf-data
+		 */
+		void push_coef(
+			const double* const* cur_qzf, double value /* = per*hf*/)
+		{
+			on_push();
+			const Index spatial_size = allocator.pusher.spatial_size();
+			auto frame = flux.middleRows(
+				allocator.pusher.idx_begin(), spatial_size);
+			for (Index id = 0; id < flux.cols(); ++id)
+			{
+				frame.col(id) =
+					VectorXd::Map(cur_qzf[id], spatial_size) / value;
+			}
+		}
+	};
+} // Convolution
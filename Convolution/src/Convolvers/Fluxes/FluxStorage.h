@@ -0,0 +1,95 @@
+#pragma once
+#include <cassert>
+#include <Eigen/Core>
+
+#include "../Allocators/AllocatorRingStep.h"
+#include "../Platform/MirroredBuffer.h"
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * @brief Flux memory of a ring allocator.
+	 * It provides the part of the VectorXd interface
+	 * used by the flux containers:
+	 * size(), operator()(idx) and segment(start, count).
+	 *
+	 * The segments are Eigen::Map-s over the mirrored pages,
+	 * so a segment wrapping around the end of the ring
+	 * is still a contiguous vector for the GEMV.
+	 */
+	class MirroredVector
+	{
+	public:
+		explicit MirroredVector(size_t min_capacity) :
+			buffer{ min_capacity }
+		{}
+
+		Index size() const noexcept
+		{
+			return static_cast<Index>(buffer.capacity());
+		}
+
+		/**
+		 * \brief The index is taken modulo size(),
+		 * an index which went below zero (in size_t) is allowed
+		 */
+		double operator()(size_t idx) const noexcept
+		{
+			Index pos = static_cast<Index>(idx) % size();
+			if (pos < 0)
+				pos += size();
+			return buffer.data()[pos];
+		}
+
+		/**
+		 * \param start position in [0; size()]
+		 * \param count nmbr of elements, count <= size()
+		 */
+		Map<VectorXd> segment(size_t start, size_t count)
+		{
+			assert(start <= buffer.capacity() && count <= buffer.capacity());
+			return Map<VectorXd>(
+				buffer.data() + start, static_cast<Index>(count));
+		}
+
+		Map<const VectorXd> segment(size_t start, size_t count) const
+		{
+			assert(start <= buffer.capacity() && count <= buffer.capacity());
+			return Map<const VectorXd>(
+				buffer.data() + start, static_cast<Index>(count));
+		}
+
+	private:
+		MirroredBuffer buffer;
+	};
+
+	/**
+	 * @brief Type of the flux memory for an allocator.
+	 * The memory is a plain VectorXd of
+	 * allocated_memory() elements, unless
+	 * the allocator is a ring.
+	 */
+	template<typename Allocator_t>
+	struct FluxStorage
+	{
+		using type = VectorXd;
+
+		static type create(const Allocator_t& convDesc)
+		{
+			return VectorXd::Zero(convDesc.pusher.allocated_memory());
+		}
+	};
+
+	template<>
+	struct FluxStorage<FluxRingStep>
+	{
+		using type = MirroredVector;
+
+		static type create(const FluxRingStep& convDesc)
+		{
+			return MirroredVector{ convDesc.ring_capacity() };
+		}
+	};
+} // Convolution
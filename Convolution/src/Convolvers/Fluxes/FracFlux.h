@@ -1,5 +1,10 @@
 #pragma once
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
 #include "BaseFluxContainer.h"
+#include "../Kernels/FracKernel.h"
 
 namespace Convolution
 {
@@ -59,19 +64,179 @@ namespace Convolution
 		 * corresponding FractrureKernel
 		 */
 		VectorXd convolved_data;
+		/**
+		 * \brief Result of convolution of a single fracture,
+		 * it is reused for every fracture
+		 */
+		VectorXd fracture_convolved;
+		/**
+		 * \brief Flux windows of all the fractures packed
+		 * lag by lag as the cols of PackedFracKernelContainer
+		 */
+		VectorXd packed_flux;
+		/**
+		 * \brief Kernels of the last convolve(),
+		 * the result stands until the next push
+		 */
+		const void* convolved_kernels{ nullptr };
+
+		/**
+		 * \brief Nmbr of leaves of the reduction tree,
+		 * 0 if the fractures are convolved one by one,
+		 * see set_parallel_reduction()
+		 */
+		size_t reduction_leaf_count{ 0ull };
+		// the fractures [leaf_begin[leaf]; leaf_begin[leaf + 1])
+		// are summed up by a leaf
+		std::vector<size_t> leaf_begin;
+		// the leaves by decreasing nmbr of nodes,
+		// the tasks are taken in this order
+		std::vector<size_t> leaf_order;
+		// result of convolution per leaf
+		std::vector<VectorXd> leaf_convolved;
 
 		/**
-		 * \brief Verifies whether the state of Fractures Container is correct.
-		 * The state is correct if the new data was pushed into every fracture.
-		 * Thus the cur_frac_id must iterate through every fracture
-		 * and return to the ZERO value.
+		 * \brief The fractures are split into the leaves
+		 * of consecutive fractures, with close nmbr of nodes per leaf
 		 */
-		void is_correct_state()
+		template<typename KernetType>
+		void split_leaves(const KernetType& kernels)
 		{
-			if (cur_frac_id != 0)
-				throw std::exception("The data was not pushed into every fracture. Cannot convolve safely.");
+			const size_t leaf_count = reduction_leaf_count;
+			size_t total = 0;
+			for (size_t frac_id = 0; frac_id < frac_count; ++frac_id)
+				total += kernels[frac_id].block_width();
+
+			leaf_begin.assign(1, 0ull);
+			size_t sum = 0;
+			for (size_t frac_id = 0; frac_id + 1 < frac_count; ++frac_id)
+			{
+				sum += kernels[frac_id].block_width();
+				const size_t closed = leaf_begin.size() - 1;
+				if (closed + 1 == leaf_count)
+					break;
+				// every leaf left gets a fracture at least
+				const size_t fracs_left = frac_count - frac_id - 1;
+				const size_t leaves_left = leaf_count - closed - 1;
+				if (sum * leaf_count >= (closed + 1) * total ||
+					fracs_left == leaves_left)
+					leaf_begin.push_back(frac_id + 1);
+			}
+			leaf_begin.push_back(frac_count);
+
+			std::vector<size_t> leaf_nodes(leaf_count, 0ull);
+			for (size_t leaf = 0; leaf < leaf_count; ++leaf)
+				for (size_t frac_id = leaf_begin[leaf]; frac_id < leaf_begin[leaf + 1]; ++frac_id)
+					leaf_nodes[leaf] += kernels[frac_id].block_width();
+			leaf_order.resize(leaf_count);
+			std::iota(leaf_order.begin(), leaf_order.end(), 0ull);
+			std::stable_sort(leaf_order.begin(), leaf_order.end(),
+				[&leaf_nodes](size_t a, size_t b)
+				{
+					return leaf_nodes[a] > leaf_nodes[b];
+				});
+			leaf_convolved.resize(leaf_count);
 		}
 
+		/**
+		 * \brief out += convolution of a fracture.
+		 * The product is evaluated in the calling thread,
+		 * by the same operations for any number of threads
+		 */
+		template<typename Flux, typename Kernel>
+		static void add_convolved(
+			const Flux& fracture_flux,
+			const Kernel& kernel,
+			VectorXd& out)
+		{
+			const auto window = kernel();
+			const auto flux_window = fracture_flux().head(window.cols());
+			if (kernel.is_banded())
+				BandedEngine::add(
+					window,
+					kernel.band_groups(kernel.window_begin(), static_cast<size_t>(window.cols())),
+					flux_window, out, 0, window.rows());
+			else
+				KernelProduct::add(window, flux_window, out);
+		}
+
+		/**
+		 * \brief The fluxes are extracted once per time step,
+		 * at the first convolve() after the push, see push_barrier().
+		 *
+		 * \return false if the same kernels are convolved again
+		 * within the time step, then the last result stands
+		 */
+		bool begin_convolve(const void* kernels)
+		{
+			if (this->push_barrier("FracturesFluxContainer_t::convolve()"))
+			{
+				for (const auto& fracture : data)
+					fracture.extract();
+			}
+			else if (kernels == convolved_kernels)
+				return false;
+			convolved_kernels = kernels;
+			return true;
+		}
+
+		/**
+		 * \brief Executes task(idx) for every idx in [0; task_count),
+		 * concurrently with POOL_CODE
+		 */
+		template<typename Task>
+		static void for_each_task(size_t task_count, const Task& task)
+		{
+#ifdef POOL_CODE
+			ThreadPool::instance().parallel_for(task_count, task);
+#else
+			for (size_t idx = 0; idx < task_count; ++idx)
+				task(idx);
+#endif
+		}
+
+		/**
+		 * \brief convolve() by the reduction tree,
+		 * see set_parallel_reduction()
+		 */
+		template<typename KernetType>
+		const VectorXd& convolve_by_tree(const KernetType& kernels)
+		{
+			if (leaf_begin.empty())
+				split_leaves(kernels);
+
+			const Index rows = static_cast<Index>(kernels[0].rows());
+			for_each_task(leaf_order.size(),
+				[this, &kernels, rows](size_t task)
+				{
+					const size_t leaf = leaf_order[task];
+					VectorXd& out = leaf_convolved[leaf];
+					out.setZero(rows);
+					for (size_t frac_id = leaf_begin[leaf]; frac_id < leaf_begin[leaf + 1]; ++frac_id)
+						add_convolved(data[frac_id], kernels[frac_id], out);
+				});
+
+			// the leaves are summed up pairwise, in the same order
+			// for every block of rows
+			convolved_data.resize(rows);
+			const size_t leaf_count = leaf_convolved.size();
+			const Index block = KernelProduct::tile_rows;
+			for_each_task(static_cast<size_t>((rows + block - 1) / block),
+				[this, rows, block, leaf_count](size_t task)
+				{
+					const Index begin = static_cast<Index>(task) * block;
+					const Index count = (std::min)(block, rows - begin);
+					for (size_t stride = 1; stride < leaf_count; stride *= 2)
+						for (size_t leaf = 0; leaf + stride < leaf_count; leaf += 2 * stride)
+							leaf_convolved[leaf].segment(begin, count) +=
+								leaf_convolved[leaf + stride].segment(begin, count);
+					convolved_data.segment(begin, count) =
+						leaf_convolved[0].segment(begin, count);
+				});
+			return convolved_data;
+		}
+
+
 	public:
 		FracturesFluxContainer_t(
 			const std::vector<typename
@@ -96,6 +261,7 @@ namespace Convolution
 		void push_coef(const double* cur_qzf, double value /* = perm*hf*/)
 		{
 			data[cur_frac_id].push_coef(cur_qzf, value); // push to the current fracture
+			this->on_push_done(cur_frac_id);
 			need_advance = true; // this->on_push_coef(); // advance to the next fracture in container in a closed loop
 			// pushing flux data is a simple single step process
 			// so, an indicator that pushing to a single fracture is done
@@ -103,6 +269,47 @@ namespace Convolution
 			cur_frac_id = (1 + cur_frac_id) % frac_count; // advance to the next fracture in container in a closed loop
 		}
 
+		/**
+		 * \brief Pushes qzf-data to the fracture frac_id.
+		 * It may be called concurrently for distinct fractures,
+		 * and in any order of the fractures.
+		 * Every fracture must be pushed before convolve(),
+		 * see push_barrier().
+		 */
+		void push_coef(
+			size_t frac_id,
+			const double* cur_qzf,
+			double value /* = perm*hf*/)
+		{
+			data[frac_id].push_coef(cur_qzf, value);
+			this->on_push_done(frac_id);
+		}
+
+		/**
+		 * \brief The fractures are convolved concurrently by convolve():
+		 * they are split into leaf_count leaves of consecutive fractures
+		 * with close nmbr of nodes per leaf, every leaf sums up its fractures
+		 * in their order, and the leaves are summed up pairwise
+		 * in a fixed tree. The leaves are taken by the threads
+		 * from the largest one, so the fractures with many nodes
+		 * do not wait for the small ones.
+		 *
+		 * The result is the same, bit for bit, for any number of threads,
+		 * while it may differ in the last bits from the result
+		 * of another leaf_count.
+		 *
+		 * \param leaf_count Nmbr of leaves, every leaf keeps a result vector,
+		 * 0 or 1 convolves the fractures one by one
+		 */
+		void set_parallel_reduction(size_t leaf_count)
+		{
+			reduction_leaf_count =
+				leaf_count > 1 ? (std::min)(leaf_count, frac_count) : 0ull;
+			leaf_begin.clear();
+			leaf_order.clear();
+			leaf_convolved.clear();
+		}
+
 		/**
 		 * \brief Method convolves fracture fluxes with fracture kernels
 		 *
@@ -115,14 +322,18 @@ namespace Convolution
 			//FracKernelContainer<KernelAllocator_t>
 			& kernels)
 		{
-			is_correct_state();
+			if (!begin_convolve(&kernels))
+				return convolved_data;
+			if (reduction_leaf_count > 1)
+				return convolve_by_tree(kernels);
 
-			/*consider declaring
-			auto*/ /* instead of VectorXd out*/
-			convolved_data = data[0].extract().convolve(kernels[0]);
+			// the results are written to the buffers
+			// of the previous time step, no memory is allocated
+			data[0].convolve_into(kernels[0], convolved_data);
 			for (size_t frac_id = 1; frac_id < frac_count; ++frac_id)
 			{
-				convolved_data += data[frac_id].extract().convolve(kernels[frac_id]);
+				data[frac_id].convolve_into(kernels[frac_id], fracture_convolved);
+				convolved_data += fracture_convolved;
 			}
 			/*without .eval() in the loop*/
 //				/*out*/ convolved_data += (kernels[frac_id].data() * data[frac_id].data()).eval();
@@ -133,6 +344,57 @@ namespace Convolution
 			return convolved_data;
 		}
 
+		/**
+		 * \brief Method convolves fracture fluxes with fracture kernels
+		 * packed into a single matrix by a single product,
+		 * see PackedFracKernelContainer.
+		 * The flux windows are packed lag by lag as the kernels,
+		 * and only the lags up to the longest window are multiplied.
+		 *
+		 * \return Result of convolution, the sum between all fractures
+		 */
+		template<typename KernelAllocator_t>
+		const auto& convolve(
+			const PackedFracKernelContainer<KernelAllocator_t>& kernels)
+		{
+			if (!begin_convolve(&kernels))
+				return convolved_data;
+
+			// the windows of the kernels are extracted,
+			// a packed window is not a block of the Kernel
+			const Index lag_width = kernels.lag_width();
+			Index live_lags = 0;
+			for (size_t frac_id = 0; frac_id < frac_count; ++frac_id)
+			{
+				auto& extractor = kernels[frac_id].allocator.extractor;
+				extractor.on_extract();
+				const Index width = static_cast<Index>(kernels[frac_id].block_width());
+				live_lags = (std::max)(live_lags, static_cast<Index>(
+					extractor.idx_begin() + extractor.current_window_size()) / width);
+			}
+
+			// the lags of a fracture beyond its window
+			// are multiplied by zero
+			const Index live_cols = live_lags * lag_width;
+			packed_flux.setZero(live_cols);
+			for (size_t frac_id = 0; frac_id < frac_count; ++frac_id)
+			{
+				const auto& extractor = kernels[frac_id].allocator.extractor;
+				const Index width = static_cast<Index>(kernels[frac_id].block_width());
+				const Index first_lag = static_cast<Index>(extractor.idx_begin()) / width;
+				const Index lags = static_cast<Index>(extractor.current_window_size()) / width;
+				const auto flux_window = data[frac_id]();
+				for (Index lag = 0; lag < lags; ++lag)
+					packed_flux.segment(
+						(first_lag + lag) * lag_width + kernels.col_offset(frac_id),
+						width) = flux_window.segment(lag * width, width);
+			}
+			ConvolutionEngineSelector<Allocator_t>::type::convolve(
+				kernels.packed_kernel().leftCols(live_cols), packed_flux, convolved_data);
+
+			return convolved_data;
+		}
+
 		/**
 		 * \brief Result of convolution for a particular spatial node
 		 *
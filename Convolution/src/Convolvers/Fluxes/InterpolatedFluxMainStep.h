@@ -0,0 +1,295 @@
+#pragma once
+#include <Eigen/Dense>
+#include <Eigen/Core>
+
+#include "WellFlux.h"
+#include "FracFlux.h"
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * @brief Flux data taken for a single convolution
+	 * in the MainStep regime. It is either a window
+	 * of the raw flux history, or a window of
+	 * the flux averaged for a small step.
+	 *
+	 * It provides the same convolve()-interface
+	 * as BaseFluxContainer.
+	 */
+	template<typename Allocator_t>
+	struct InterpolatedFluxView
+	{
+		InterpolatedFluxView(const double* data, size_t rows) :
+			data{ data, static_cast<Index>(rows) }
+		{}
+
+		auto operator()() const
+		{
+			return data;
+		}
+
+		size_t rows() const
+		{
+			return static_cast<size_t>(data.size());
+		}
+
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
+		VectorXd convolve(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel) const
+		{
+			VectorXd out;
+			convolve_into(kernel, out);
+			return out;
+		}
+
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
+		void convolve_into(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel,
+			VectorXd& out) const
+		{
+			const auto window = kernel();
+			convolve_window<Allocator_t>(
+				kernel, window, kernel.window_begin(), data, out);
+		}
+
+	protected:
+		Map<const VectorXd> data;
+	};
+
+	/**
+	 * @brief A replacement of BaseFluxContainerMainStep
+	 * which stores the flux history once,
+	 * instead of small_step_nmbr averaged copies.
+	 *
+	 * The flux averaged for the small step i
+	 * (ratio = (i+1)/small_step_nmbr) is
+	 *		ratio * q[k] + (1 - ratio) * q[k-1],
+	 * so it is a linear combination of two windows
+	 * of the same history: the raw one, q[k],
+	 * and the one a time frame earlier, q[k-1],
+	 * see BaseFluxContainer::earlier_window().
+	 * The history is stored once, and the averaged window
+	 * is produced on extract() for the small step
+	 * it is required for.
+	 *
+	 * So, the memory and the push cost do not depend
+	 * on small_step_nmbr.
+	 */
+	template<
+		typename Allocator_t,
+		template<typename Allocator_t> typename Flux_t>
+	struct InterpolatedFluxContainerMainStep :
+		public FluxTypedefs<Allocator_t>
+	{
+		using View = InterpolatedFluxView<Allocator_t>;
+		using result_type = VectorXd;
+
+		/**
+		 * @brief ctor
+		 */
+		InterpolatedFluxContainerMainStep(
+			const Allocator_t& convDesc) :
+			raw_flux{ convDesc },
+			main_step_counter{ 0ull },
+			small_step_nmbr{ convDesc.small_step_nmbr },
+			// initially the raw, non-averaged flux is used
+			cur_small_step{ convDesc.small_step_nmbr - 1 },
+			main_step_nmbr{ convDesc.main_step_nmbr }
+		{}
+
+		size_t flux_push_counter() const noexcept
+		{
+			return raw_flux.allocator.pushed_data_counter();
+		}
+
+		size_t flux_push_nmbr() const noexcept
+		{
+			return raw_flux.allocator.push_data_nmbr();
+		}
+
+		/**
+		 * @brief The method pushes data to
+		 * flux container.
+		 *
+		 * It takes into account that fractures and
+		 * well take different set of parameters,
+		 * so Args... expands differently for fracs and well.
+		 */
+		template<typename... Args>
+		void push_coef(Args... args)
+		{
+			raw_flux.push_coef(raw_flux.calc_coef(args...));
+		}
+
+		/**
+		 * \brief In the first part of the history
+		 * the history is extracted and the raw window is taken.
+		 *
+		 * In the second part of the history
+		 * nothing is extracted, and the window averaged for
+		 * the next small step is produced.
+		 */
+		View extract()
+		{
+			if (main_step_counter < main_step_nmbr)
+			{
+				++main_step_counter;
+				raw_flux.extract();
+			}
+			else
+			{
+				cur_small_step = (cur_small_step + 1) % small_step_nmbr;
+			}
+			return view(cur_small_step);
+		}
+
+		/**
+		 * \brief Flux window for a small step
+		 * within the current main step.
+		 * The small step small_step_nmbr - 1 is the raw flux.
+		 */
+		View view(size_t small_step) const
+		{
+			assert(small_step < small_step_nmbr);
+			auto raw = raw_flux();
+			if (small_step + 1 == small_step_nmbr)
+				return View{ raw.data(), static_cast<size_t>(raw.size()) };
+
+			double ratio =
+				static_cast<double>(small_step + 1) /
+				static_cast<double>(small_step_nmbr);
+			// q[-1] == 0 is not stored
+			auto prev = raw_flux.earlier_window(1);
+			const Index prev_size = prev.size();
+			averaged_flux.resize(raw.size());
+			averaged_flux.head(prev_size).noalias() =
+				ratio * raw.head(prev_size) + (1.0 - ratio) * prev;
+			averaged_flux.tail(raw.size() - prev_size) =
+				ratio * raw.tail(raw.size() - prev_size);
+			return View{ averaged_flux.data(), static_cast<size_t>(averaged_flux.size()) };
+		}
+
+		/**
+		 * \brief Takes the fluxes of all the small steps
+		 * of the next main step at once.
+		 * It replaces small_step_nmbr calls of extract()
+		 * in the second part of the history.
+		 *
+		 * The averaged fluxes are not produced:
+		 * only the raw and the earlier windows are taken,
+		 * together with the weights of every small step.
+		 *
+		 * \return Matrix of the raw and the earlier flux windows
+		 */
+		const MatrixXd& extract_main_step()
+		{
+			assert(main_step_counter >= main_step_nmbr);
+			// the batch must start at the first small step
+			assert(cur_small_step == small_step_nmbr - 1);
+
+			auto raw = raw_flux();
+			main_step_flux.resize(raw.size(), 2);
+			main_step_flux.col(0) = raw;
+			auto prev = raw_flux.earlier_window(1);
+			main_step_flux.col(1).head(prev.size()) = prev;
+			main_step_flux.col(1).tail(raw.size() - prev.size()).setZero();
+
+			main_step_weights.resize(2, small_step_nmbr);
+			for (size_t step_id = 0; step_id < small_step_nmbr; ++step_id)
+			{
+				double ratio =
+					static_cast<double>(step_id + 1) /
+					static_cast<double>(small_step_nmbr);
+				main_step_weights(0, step_id) = ratio;
+				main_step_weights(1, step_id) = 1.0 - ratio;
+			}
+			// all the small steps are taken
+			cur_small_step = small_step_nmbr - 1;
+			return main_step_flux;
+		}
+
+		/**
+		 * \brief Convolves the kernel with the fluxes
+		 * of all the small steps of a main step.
+		 * The kernel window is multiplied by two columns
+		 * (raw and earlier), then the result is combined
+		 * with the weights of the small steps.
+		 * The kernel is extracted small_step_nmbr times,
+		 * as it would be by the small step convolutions.
+		 *
+		 * \return Matrix of size (kernel.rows(); small_step_nmbr),
+		 * the column i is the result for the small step i
+		 */
+		template<typename KernelAllocator_t, typename KernelStorage_t, typename KernelCoefs_t>
+		MatrixXd convolve_main_step(
+			const BaseKernel<KernelAllocator_t, KernelStorage_t, KernelCoefs_t>& kernel) const
+		{
+			auto window = kernel();
+			const size_t window_begin = kernel.window_begin();
+			for (size_t step_id = 1; step_id < small_step_nmbr; ++step_id)
+				kernel.allocator.extractor.on_extract();
+
+			MatrixXd pair;
+			convolve_window<Allocator_t>(
+				kernel, window, window_begin, main_step_flux, pair);
+			return pair * main_step_weights;
+		}
+
+		double operator()(size_t nt, size_t segm_id) const
+		{
+			if (nt - 1 < main_step_nmbr)
+				// first part of history
+				return raw_flux(nt, segm_id);
+			else
+			{
+				// second part of history
+				size_t small_step = (nt - 1 - main_step_nmbr) % small_step_nmbr;
+				double ratio =
+					static_cast<double>(small_step + 1) /
+					static_cast<double>(small_step_nmbr);
+				auto prev = raw_flux.earlier_window(1);
+				return
+					ratio * raw_flux()(segm_id) +
+					(1.0 - ratio) *
+					(static_cast<Index>(segm_id) < prev.size() ? prev(segm_id) : 0.0);
+			}
+		}
+
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			visitor.object(raw_flux);
+			visitor.pod(main_step_counter);
+			visitor.pod(cur_small_step);
+		}
+
+	protected:
+		// q[k], the window of q[k-1] is a frame older
+		Flux_t<Allocator_t> raw_flux;
+		// memory for the averaged window,
+		// it is reused on every extract()
+		mutable VectorXd averaged_flux;
+		// raw and earlier windows and the weights
+		// of all the small steps of a main step,
+		// see extract_main_step()
+		MatrixXd main_step_flux;
+		MatrixXd main_step_weights;
+
+	protected:
+		size_t main_step_counter;
+		const size_t small_step_nmbr;
+		size_t cur_small_step;
+
+		const size_t main_step_nmbr;
+	};
+
+	template<typename Allocator_t>
+	using InterpolatedWellFluxMainStep =
+		InterpolatedFluxContainerMainStep<Allocator_t, BaseWellFlux>;
+
+	template<typename Allocator_t>
+	using InterpolatedFracFluxMainStep =
+		InterpolatedFluxContainerMainStep<Allocator_t, BaseFracFlux>;
+} // Convolution
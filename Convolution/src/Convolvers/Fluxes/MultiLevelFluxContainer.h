@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <Eigen/Dense>
+#include <Eigen/Core>
+
+#include "BaseFluxContainer.h"
+#include "../Allocators/AllocatorMultiLevel.h"
+#include "../Kernels/CumulativeKernel.h"
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * \brief Container to store the flux data
+	 * in the bins of the MultiLevel regime,
+	 * see AllocatorMultiLevel.h.
+	 *
+	 * A bin stores the flux averaged over its time frames,
+	 * and it is convolved with the sum of the kernel lags
+	 * it covers. So the result is exact
+	 * if the flux is constant within every bin.
+	 */
+	template<typename Allocator_t /* = FluxMultiLevel */>
+	class BaseMultiLevelFlux : public CommonBase<Allocator_t>
+	{
+	protected:
+		// (spatial_size; bin_capacity), a bin per col,
+		// the newest bin is the first one
+		MatrixXd bins;
+		// the difference of two bins, reused by every convolution
+		mutable VectorXd flux_delta;
+
+	public:
+		using result_type = VectorXd;
+
+		BaseMultiLevelFlux(
+			const typename KernelTypedefs<Allocator_t>::Allocator&
+			convDesc) :
+			CommonBase<Allocator_t>{ convDesc },
+			bins{ MatrixXd::Zero(
+				convDesc.pusher.spatial_size(),
+				convDesc.bin_capacity()) }
+		{}
+
+		size_t bin_count() const noexcept
+		{
+			return allocator.pusher.bin_count();
+		}
+
+		/**
+		 * \brief Returns the flux-data for a linear source term
+		 * which is associated with a segment and a time frame.
+		 * It is the average of the bin the time frame belongs to.
+		 *
+		 * \param nt time frame for the flux data, 1 is the first one
+		 * \param segm_id segment of the linear source term associated with the flux-data
+		 */
+		double operator()(size_t nt, size_t segm_id) const
+		{
+			const LevelsDesc& levels = allocator.pusher;
+			// lag of the time frame, 0 is the newest one
+			const size_t lag = allocator.pushed_data_counter() - nt;
+			size_t lag_end = 0;
+			size_t bin_id = 0;
+			for (size_t level = 0; level < levels.level_count(); ++level)
+				for (size_t id = 0; id < levels.level_bin_count(level); ++id, ++bin_id)
+				{
+					lag_end += size_t{ 1 } << level;
+					if (lag < lag_end)
+						return bins(
+							static_cast<Index>(segm_id),
+							static_cast<Index>(bin_id));
+				}
+			// the time frame is forgotten
+			return 0.0;
+		}
+
+		/**
+		 * \brief Returns the bins already pushed to the container,
+		 * an Eigen::Block of size (spatial_size; bin_count)
+		 */
+		auto operator()() const
+		{
+			return bins.leftCols(
+				static_cast<Index>(bin_count()));
+		}
+
+		/**
+		 * \brief Convolution of the bins with the kernel.
+		 * The bin j covers the lags [a_j; a_j+1), so
+		 *		sum_j (C[a_j+1] - C[a_j]) * q_j =
+		 *		sum_j C[a_j+1] * (q_j - q_j+1),
+		 * where C[a] is the sum of the lags [0; a).
+		 * Only a block of the kernel per bin is read.
+		 *
+		 * \return Result of convolution for all mesh points
+		 */
+		template<
+			template<typename KernelAllocator_t> typename Kernel_t,
+			typename KernelAllocator_t>
+		VectorXd convolve(
+			const CumulativeKernel<Kernel_t, KernelAllocator_t>& kernel) const
+		{
+			VectorXd out;
+			convolve_into(kernel, out);
+			return out;
+		}
+
+		/**
+		 * \brief Same as convolve(), the memory of out is reused
+		 */
+		template<
+			template<typename KernelAllocator_t> typename Kernel_t,
+			typename KernelAllocator_t>
+		void convolve_into(
+			const CumulativeKernel<Kernel_t, KernelAllocator_t>& kernel,
+			VectorXd& out) const
+		{
+			const auto window = kernel();
+			const Index spatial_size = static_cast<Index>(
+				allocator.extractor.spatial_size());
+			const size_t lags = static_cast<size_t>(window.cols() / spatial_size);
+			const OnGetFluxMultiLevel& levels = allocator.extractor;
+
+			out.setZero(window.rows());
+			flux_delta.resize(spatial_size);
+			const Index count = static_cast<Index>(levels.bin_count());
+			size_t lag_end = 0;
+			Index bin_id = 0;
+			for (size_t level = 0; level < levels.level_count() && lag_end < lags; ++level)
+				for (size_t id = 0;
+					id < levels.level_bin_count(level) && lag_end < lags;
+					++id, ++bin_id)
+				{
+					lag_end = (std::min)(lag_end + (size_t{ 1 } << level), lags);
+					flux_delta = bins.col(bin_id);
+					if (bin_id + 1 < count && lag_end < lags)
+						flux_delta -= bins.col(bin_id + 1);
+					out.noalias() += kernel.cumulative(lag_end) * flux_delta;
+				}
+		}
+
+		const BaseMultiLevelFlux<Allocator_t>& extract() const
+		{
+			CommonBase<Allocator_t>::
+				on_extract();
+			return *this;
+		}
+
+		/**
+		 * \brief The new time frame becomes the first bin,
+		 * then the bins are merged as the allocator requires
+		 */
+		template<typename T>
+		void push_coef(const T& data)
+		{
+			Index count = static_cast<Index>(bin_count());
+			on_push();
+
+			// move the bins to give place for the new one
+			double* begin = bins.data();
+			const Index rows = bins.rows();
+			std::copy_backward(begin, begin + count * rows, begin + (count + 1) * rows);
+			bins.col(0) = data;
+			++count;
+
+			for (size_t position : allocator.pusher.merges())
+			{
+				const Index p = static_cast<Index>(position);
+				bins.col(p) = 0.5 * (bins.col(p) + bins.col(p + 1));
+				std::copy(
+					begin + (p + 2) * rows, begin + count * rows,
+					begin + (p + 1) * rows);
+				--count;
+			}
+			// the oldest bins are forgotten
+			// as they are beyond the external boundary
+		}
+	};
+
+	/**
+	 * @brief Provides the logic of data addition to the
+	 * MultiLevel container for wells, where the flux-log is divided
+	 * by the permeability-log.
+	 */
+	template<typename Allocator_t>
+	class MultiLevelWellFlux :
+		public BaseMultiLevelFlux<Allocator_t>
+	{
+	public:
+		using BaseMultiLevelFlux<Allocator_t>::BaseMultiLevelFlux;
+		using BaseMultiLevelFlux<Allocator_t>::push_coef;
+
+		/**
+		 * \brief Method pushes the qzi/permeability ratio at a new time moment
+		 */
+		void push_coef(const double* cur_qzi, const double* perm)
+		{
+			BaseMultiLevelFlux<Allocator_t>::push_coef(
+				calc_coef(cur_qzi, perm).matrix());
+		}
+
+		auto calc_coef(
+			const double* cur_qzi,
+			const double* perm)
+		{
+			return ArrayXd::Map(cur_qzi, allocator.pusher.spatial_size()) /
+				ArrayXd::Map(perm, allocator.pusher.spatial_size());
+		}
+	};
+
+	/**
+	 * @brief Provides the logic of data addition to the
+	 * MultiLevel container for fractures, where qzf
+	 * is divided by per*hf.
+	 */
+	template<typename Allocator_t>
+	class MultiLevelFracFlux :
+		public BaseMultiLevelFlux<Allocator_t>
+	{
+	public:
+		using BaseMultiLevelFlux<Allocator_t>::BaseMultiLevelFlux;
+		using BaseMultiLevelFlux<Allocator_t>::push_coef;
+
+		/**
+		 * \brief Method pushes the qzf/(permeability*hf) ratio at a new time moment
+		 */
+		void push_coef(
+			const double* cur_qzf, double value /* = per*hf*/)
+		{
+			BaseMultiLevelFlux<Allocator_t>::push_coef(
+				calc_coef(cur_qzf, value).matrix());
+		}
+
+		auto calc_coef(
+			const double* cur_qzf,
+			double value /* = per*hf*/)
+		{
+			return ArrayXd::Map(cur_qzf, allocator.pusher.spatial_size()) /
+				value;
+		}
+	};
+} // Convolution
@@ -1,11 +1,18 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
 #include <string>
 #include <exception>
+#include <stdexcept>
+#include <type_traits>
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
 #include "../ConvolutionDefines.h"
+#include "../Allocators/AllocatorConstStep.h"
+#include "KernelStorage.h"
+#include "KernelCoefs.h"
+#include "KernelBands.h"
 
 namespace Convolution
 {
@@ -25,8 +32,19 @@ namespace Convolution
 	 * @brief Class provides basic interface 
 	 * to allocated memory and allows for
 	 * access of the coefficients.
+	 * 
+	 * @tparam Storage_t Policy which allocates the Kernel matrix,
+	 * KernelStorageRAM or KernelStorageFile,
+	 * or KernelStorage{Float, BFloat16, Half} to keep
+	 * the coefficients in a lower precision
+	 * @tparam Coefs_t Policy of the staging coefficients,
+	 * KernelCoefsFull, or KernelCoefsUnitF and KernelCoefsFrac
+	 * which do not store F, see KernelCoefs.h
 	 */
-	template<typename Allocator_t>
+	template<
+		typename Allocator_t, 
+		typename Storage_t = KernelStorageRAM,
+		typename Coefs_t = KernelCoefsFull>
 	class BaseKernel : public KernelTypedefs<Allocator_t>
 	{
 	protected:
@@ -40,13 +58,161 @@ namespace Convolution
 			allocator.extractor.on_extract();
 		}
 
+		/**
+		 * \brief The new block of coefficients computed in double
+		 * is stored to the Kernel. The rounding error of a lower
+		 * precision storage is accumulated in the precision report.
+		 */
+		template<typename Block, typename Exact>
+		void store_block(Block&& block, const Exact& exact)
+		{
+			if constexpr (std::is_same<Scalar, double>::value)
+				block = exact;
+			else
+			{
+				store_buffer = exact;
+				block = store_buffer.template cast<Scalar>();
+				precision.add(store_buffer, block);
+			}
+		}
+
+		/**
+		 * \brief Rows of the new lag block F*(P_cur - P_prev),
+		 * F is not multiplied unless it is stored
+		 */
+		auto new_block(Index row_begin, Index row_count) const
+		{
+			if constexpr (Coefs_t::has_F)
+				return (
+					F.middleRows(row_begin, row_count) * (
+						P_cur.middleRows(row_begin, row_count) -
+						P_prev.middleRows(row_begin, row_count))).matrix();
+			else
+				return (
+					P_cur.middleRows(row_begin, row_count) -
+					P_prev.middleRows(row_begin, row_count)).matrix();
+		}
+
+		Map<ArrayXXd> F_view()
+		{
+			if constexpr (Coefs_t::has_F)
+				return Map<ArrayXXd>{ F.data(), F.rows(), F.cols() };
+			else
+				return Map<ArrayXXd>{ nullptr, 0, 0 };
+		}
+
+		KernelPrecisionReport precision;
+		// the block in double before it is rounded,
+		// it is reused by every advance()
+		MatrixXd store_buffer;
+		// the policy the Kernel is allocated by,
+		// it places the lag blocks, see lag_block()
+		Storage_t storage_policy;
+
+		/**
+		 * \brief The lag block whose first col
+		 * in the kernel is col. It is the block of the Kernel
+		 * at the same col unless the lags of the storage
+		 * are not contiguous, see KernelStoragePacked.
+		 */
+		auto lag_block(size_t col)
+		{
+			return Kernel.leftCols(stored_cols()).middleCols(
+				storage_policy.lag_col(
+					static_cast<Index>(col), static_cast<Index>(block_width())),
+				block_width());
+		}
+
+		auto lag_block(size_t col) const
+		{
+			return Kernel.leftCols(stored_cols()).middleCols(
+				storage_policy.lag_col(
+					static_cast<Index>(col), static_cast<Index>(block_width())),
+				block_width());
+		}
+
+		/**
+		 * \brief The lag blocks are set to zero,
+		 * the cols of the other kernels in a shared storage are kept
+		 */
+		void set_zero_lags()
+		{
+			if constexpr (Storage_t::contiguous_lags)
+				Kernel.leftCols(stored_cols()).setZero();
+			else
+				for (size_t col = 0; col < allocator.pusher.allocated_memory(); col += block_width())
+					lag_block(col).setZero();
+		}
+
+		// the external boundary is declared once the norm
+		// of a new lag block falls below boundary_tolerance
+		// times the max norm of the previous blocks,
+		// 0 switches the detection off
+		double boundary_tolerance{ 0.0 };
+		double max_block_norm{ 0.0 };
+		bool external_boundary{ false };
+
+		// the window of the extractor can be limited at runtime
+		static constexpr bool has_adaptive_boundary =
+			std::is_same<typename Allocator_t::BaseExtract, OnGetKernelConstStep>::value;
+
+		/**
+		 * \brief The new lag block is checked against
+		 * the boundary tolerance, see set_external_boundary_tolerance().
+		 * If the block is beyond the external boundary,
+		 * it is dropped and the boundary is declared.
+		 */
+		template<typename Block>
+		void check_external_boundary(const Block& block)
+		{
+			if (boundary_tolerance <= 0.0)
+				return;
+			const double norm = block.template cast<double>().norm();
+			if (allocator.pusher.pushed_data_counter() == 0 ||
+				norm > boundary_tolerance * max_block_norm)
+				max_block_norm = (std::max)(max_block_norm, norm);
+			else
+				declare_external_boundary();
+		}
+
+		/**
+		 * \brief The window of the extractor stops growing
+		 * at the lags pushed so far,
+		 * and the columns beyond them are released
+		 */
+		void declare_external_boundary()
+		{
+			external_boundary = true;
+			const size_t index_end = allocator.pusher.idx_end();
+			if constexpr (has_adaptive_boundary)
+				allocator.extractor.set_external_boundary(index_end);
+			Storage_t::shrink(Kernel, static_cast<Index>(index_end));
+		}
+
+		// row bands of the lag blocks,
+		// empty unless enable_row_bands() is called
+		KernelBands row_bands;
+
+		/**
+		 * \brief The band of the lag block at col is recorded
+		 */
+		void record_row_band(Index col)
+		{
+			if (!row_bands.empty())
+				row_bands.record(
+					lag_block(static_cast<size_t>(col)), col);
+		}
+
 	public:
+		// type of the stored coefficients
+		using Scalar = typename Storage_t::Scalar;
+
 		/**
 		 * \brief A ColMajor matrix which is convolved with fluxes
 		 * Its columns are filled in with the products
 		 * F*(P_cur - P_prev)
 		 */
-		MatrixXd Kernel; 
+		typename Storage_t::matrix_type Kernel; 
 		/**
 		 * \brief P-coefficients at a previous time step, 
 		 *	size: number of mesh points (Ns*Ny*Nz) BY number of sources (well_nodes || frac_nodes)
@@ -59,9 +225,10 @@ namespace Convolution
 		ArrayXXd P_cur; 
 		/**
 		 * \brief F-coefficients for F(E-E)-product, 
-		 * or F==1 if F(P-P)
+		 * or F==1 if F(P-P).
+		 * It is not stored unless Coefs_t::has_F
 		 */
-		ArrayXXd F; 
+		typename Coefs_t::F_type F; 
 		/**
 		 * \brief Number of spatial grid nodes,
 		 * number of rows in the Kernel
@@ -113,6 +280,19 @@ namespace Convolution
 					block_height(),
 					block_width());
 		}
+		/**
+		 * \brief P_cur becomes P_prev, and the memory
+		 * of the old P_prev is reused for the new P_cur,
+		 * so no memory is allocated at a time step
+		 */
+		void swap_P()
+		{
+			P_prev.swap(P_cur);
+			if (P_cur.rows() != P_prev.rows() || P_cur.cols() != P_prev.cols())
+				allocate_P_cur();
+			else
+				P_cur.setZero();
+		}
 		/**
 		 * \brief Verifies whether the state of the object is correct
 		 * 
@@ -139,13 +319,18 @@ namespace Convolution
 		double operator()(size_t row, size_t col) const
 		{
 			is_correct_state();
-			return Kernel(row, col);
+			return static_cast<double>(Kernel(row, storage_policy.lag_col(
+				static_cast<Index>(col), static_cast<Index>(block_width()))));
 		}
 	public:
 		BaseKernel(
 			size_t nodesCount,
-			const typename KernelTypedefs<Allocator_t>::Allocator& convDesc) :
-			Kernel{ nodesCount, convDesc.pusher.allocated_memory() },
+			const typename KernelTypedefs<Allocator_t>::Allocator& convDesc,
+			const Storage_t& storage = Storage_t{}) :
+			storage_policy{ storage },
+			Kernel{ storage.create(
+				static_cast<Index>(nodesCount), 
+				static_cast<Index>(convDesc.pusher.allocated_memory())) },
 			grid_nodes_count{ nodesCount },
 			allocator{ convDesc }
 		{
@@ -153,7 +338,8 @@ namespace Convolution
 			// since it calls class fields that may not be initialized
 			// at a proper time moment
 			P_prev = ArrayXXd::Zero(block_height(), block_width());
-			F = ArrayXXd::Ones(block_height(), block_width());
+			if constexpr (Coefs_t::has_F)
+				F = ArrayXXd::Ones(block_height(), block_width());
 
 			allocate_P_cur();
 		}
@@ -178,10 +364,54 @@ namespace Convolution
 			size_t row, size_t col, 
 			double E, double f)
 		{
+			static_assert(Coefs_t::has_F,
+				"BaseKernel::push_coef() : F is not stored by the coefficient policy.");
 			P_cur(row, col) = E;
 			F(row, col) = f;
 			allocator.pusher.need_advance = true;
 		}
+
+		/**
+		 * @brief Writable views of the staging blocks
+		 * P_cur, F and P_prev, of size (block_height; block_width).
+		 * The view of F is empty if F is not stored.
+		 * The coefficients are generated right into them,
+		 * instead of a buffer which is copied by push_coef().
+		 *
+		 * The views are valid until the next advance(),
+		 * since advance() swaps the memory of P_cur and P_prev,
+		 * and until the next commit_coef() of a fracture kernel,
+		 * see BasicFracKernel::commit_coef().
+		 */
+		struct CoefWriter
+		{
+			Map<ArrayXXd> P_cur;
+			Map<ArrayXXd> F;
+			Map<ArrayXXd> P_prev;
+		};
+
+		/**
+		 * \brief Views to write the coefficients in place,
+		 * then commit_coef() is to be called
+		 */
+		CoefWriter coef_writer()
+		{
+			return CoefWriter{
+				Map<ArrayXXd>{ P_cur.data(), P_cur.rows(), P_cur.cols() },
+				F_view(),
+				Map<ArrayXXd>{ P_prev.data(), P_prev.rows(), P_prev.cols() } };
+		}
+
+		/**
+		 * \brief The coefficients written through coef_writer()
+		 * are pushed, so the state is to be fixed with advance()
+		 */
+		void commit_coef()
+		{
+#ifdef PUSHER_ADVANCE_FLAG
+			allocator.pusher.need_advance = true;
+#endif
+		}
 		/**
 		 * \brief Returns the Matrix coefficient according to its physical meaning.
 		 * 
@@ -240,7 +470,10 @@ namespace Convolution
 			size_t node_id,
 			size_t source_node_id) const
 		{
-			return F(node_id, source_node_id);
+			if constexpr (Coefs_t::has_F)
+				return F(node_id, source_node_id);
+			else
+				return 1.0;
 		}
 
 		const auto& get_P_prev() const
@@ -260,6 +493,8 @@ namespace Convolution
 		 */
 		auto operator()() const
 		{
+			static_assert(Storage_t::contiguous_lags,
+				"BaseKernel::operator()() : the window of a packed kernel is not a block of the Kernel, see PackedFracKernelContainer.");
 			is_correct_state();
 			// this is for ConstStep
 			// when large steps are not split into smaller steps.
@@ -272,11 +507,233 @@ namespace Convolution
 			// and the coef-frame moves,
 			// its end idx as well as begin index
 			on_extract();
+			Storage_t::advise_read(
+				Kernel,
+				allocator.extractor.idx_begin(),
+				allocator.extractor.current_window_size());
 			return Kernel.middleCols(
 				allocator.extractor.idx_begin(),
 				allocator.extractor.current_window_size());
 		}
 
+		/**
+		 * \brief Returns the first (newest) lag block
+		 * of the window taken by the last operator()() call.
+		 * It is multiplied by the flux of the current time step,
+		 * so it is the Jacobian of the convolution
+		 * with respect to that flux.
+		 *
+		 * Unlike operator()() it does not extract,
+		 * so it can be called at every Newton iteration.
+		 *
+		 * \return Matrix block of size (rows; block_width), no copy is made
+		 */
+		auto jacobian() const
+		{
+			is_correct_state();
+			return lag_block(allocator.extractor.idx_begin());
+		}
+
+		/**
+		 * \brief Accuracy of the stored coefficients against
+		 * the double ones computed by advance(),
+		 * it is empty for a double storage
+		 */
+		const KernelPrecisionReport& precision_report() const noexcept
+		{
+			return precision;
+		}
+
+		/**
+		 * \brief Whether advance() can be fused with the convolution,
+		 * see BaseFluxContainer::advance_convolve_into():
+		 * the Kernel is a ConstStep double one, without row bands
+		 * and the adaptive external boundary, its window
+		 * is extracted once per advance(), and the new lag block
+		 * is within the allocated memory.
+		 * The kernels with another advance() hide it.
+		 */
+		bool can_fuse_advance() const noexcept
+		{
+			if constexpr (has_adaptive_boundary &&
+				std::is_same<Scalar, double>::value &&
+				Storage_t::contiguous_lags)
+				return boundary_tolerance <= 0.0 &&
+					!external_boundary &&
+					row_bands.empty() &&
+					allocator.extractor.idx_end() == allocator.pusher.idx_end() &&
+					block_stride_in_row() + block_width() <= static_cast<size_t>(stored_cols());
+			else
+				return false;
+		}
+
+		/**
+		 * \brief The rows [row_begin; row_begin + row_count)
+		 * of the new lag block are computed and stored,
+		 * it is a part of advance() for the fused convolution.
+		 * The calls for different rows may run concurrently.
+		 *
+		 * \return The stored rows of the block
+		 */
+		auto store_block_rows(Index row_begin, Index row_count)
+		{
+			auto block = Kernel.block(
+				row_begin, static_cast<Index>(block_stride_in_row()),
+				row_count, static_cast<Index>(block_width()));
+			block = new_block(row_begin, row_count);
+			return block;
+		}
+
+		/**
+		 * \brief Once all the rows of the new lag block are stored
+		 * by store_block_rows(), the state is advanced as by advance()
+		 */
+		void commit_advance()
+		{
+			swap_P();
+			on_advance();
+		}
+
+		/**
+		 * \brief The Kernel and P_prev of the first lags
+		 * are filled in from outside, e.g., by KernelCache,
+		 * so the kernel continues as if it was advanced lags times
+		 */
+		void restore_advanced(size_t lags)
+		{
+			if (allocator.pusher.pushed_data_counter() != 0)
+				throw std::runtime_error(
+					"BaseKernel::restore_advanced() : The kernel has been advanced already.");
+			for (size_t lag = 0; lag < lags; ++lag)
+			{
+				record_row_band(static_cast<Index>(block_stride_in_row()));
+				on_advance();
+			}
+			allocate_P_cur();
+		}
+
+		/**
+		 * \brief The Kernel is stored by the row bands of its lag blocks:
+		 * once a lag block is written by advance(), the contiguous
+		 * range of its rows above the tolerance is recorded,
+		 * and the rows beyond it are set to zero.
+		 * The convolution skips the zero rows, see BandedEngine.
+		 *
+		 * It pays off at the early lags and on the meshes
+		 * with a large far field, where the pressure
+		 * has not reached most of the nodes.
+		 *
+		 * \param tolerance the rows whose max coefficient is not above
+		 * tolerance * max coefficient of the block are dropped,
+		 * 0 drops only the zero rows
+		 */
+		void enable_row_bands(double tolerance = 0.0)
+		{
+			static_assert(Storage_t::contiguous_lags,
+				"BaseKernel::enable_row_bands() : the lags of the storage are not contiguous.");
+			const size_t width = block_width();
+			row_bands = KernelBands{
+				static_cast<size_t>(stored_cols()) / width,
+				static_cast<Index>(width), tolerance };
+			// the lag blocks written so far
+			for (size_t col = 0; col < block_stride_in_row(); col += width)
+				record_row_band(static_cast<Index>(col));
+		}
+
+		bool is_banded() const noexcept
+		{
+			return !row_bands.empty();
+		}
+
+		/**
+		 * \brief Groups of the row bands of the cols
+		 * [col_begin; col_begin + col_count) of the Kernel,
+		 * e.g., of a window taken by operator()()
+		 */
+		const std::vector<BandedBlock>& band_groups(
+			size_t col_begin, size_t col_count) const
+		{
+			return row_bands.groups(
+				static_cast<Index>(col_begin),
+				static_cast<Index>(col_count));
+		}
+
+		/**
+		 * \brief Index of the first col of the window
+		 * taken by the last operator()() call
+		 */
+		size_t window_begin() const noexcept
+		{
+			return allocator.extractor.idx_begin();
+		}
+
+		/**
+		 * \brief The external boundary is detected at runtime:
+		 * once a new lag block is negligible,
+		 *		||block|| <= tolerance * max ||previous block||,
+		 * the kernel stops growing, so frame_temporal_size
+		 * is only an upper bound of the frame.
+		 * It is available for the ConstStep kernels.
+		 *
+		 * \param tolerance relative to the largest lag block,
+		 * 0 switches the detection off
+		 */
+		void set_external_boundary_tolerance(double tolerance)
+		{
+			if (!has_adaptive_boundary && tolerance > 0.0)
+				throw std::runtime_error(
+					"BaseKernel::set_external_boundary_tolerance() : the allocator does not support the adaptive external boundary.");
+			boundary_tolerance = tolerance;
+		}
+
+		/**
+		 * \brief Whether the external boundary has been detected,
+		 * then advance() does not add lags any more
+		 */
+		bool is_external_boundary() const noexcept
+		{
+			return external_boundary;
+		}
+
+		/**
+		 * \brief Nmbr of the cols of the Kernel which are kept,
+		 * the ones beyond the external boundary are released
+		 * by declare_external_boundary()
+		 */
+		Index stored_cols() const noexcept
+		{
+			return Storage_t::stored_cols(Kernel);
+		}
+
+		/**
+		 * \brief Only the filled columns of the Kernel are passed
+		 */
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			visitor.pod(allocator);
+			if constexpr (Storage_t::contiguous_lags)
+				visitor.region(
+					Kernel.data(),
+					allocator.pusher.idx_end() * grid_nodes_count * sizeof(Scalar));
+			else
+				for (size_t col = 0; col < allocator.pusher.idx_end(); col += block_width())
+					visitor.region(
+						lag_block(col).data(),
+						block_width() * grid_nodes_count * sizeof(Scalar));
+			visitor.array(P_prev);
+			visitor.array(P_cur);
+			if constexpr (Coefs_t::has_F)
+				visitor.array(F);
+			visitor.pod(precision);
+			visitor.pod(max_block_norm);
+			visitor.pod(external_boundary);
+			visitor.region(
+				row_bands.data(),
+				row_bands.size() * sizeof(RowBand));
+			row_bands.touch();
+		}
+
 		/**
 		 * \brief Method is responsible for advance in time at a single time step.
 		 *
@@ -287,22 +744,37 @@ namespace Convolution
 		 */
 		void advance()
 		{
-			// calculate a new block and send it to Kernel,
-			// at appropriate positions
-			Kernel.middleCols(
-				block_stride_in_row(), block_width()) =
-				F * (P_cur - P_prev);
+			if (!external_boundary)
+			{
+				// calculate a new block and send it to Kernel,
+				// at appropriate positions
+				auto block = lag_block(block_stride_in_row());
+				store_block(block, new_block(0, static_cast<Index>(block_height())));
+				check_external_boundary(block);
+				if (!external_boundary)
+					record_row_band(static_cast<Index>(block_stride_in_row()));
+			}
 
-			P_prev = std::move(P_cur);
-			allocate_P_cur();
+			swap_P();
+			// beyond the external boundary
+			// the lags are not added
+			if (external_boundary)
+				return;
 			// prepare the initial state for the next time moment
 			// fix the current state
 			on_advance();
 		}
 	};
 
+	/**
+	 * @brief The Kernel matrix is mapped to a scratch file
+	 * named after the kernel in the directory
+	 * (see KernelStorageFile), so the kernels may exceed the RAM.
+	 * The columns written by advance() go to the file,
+	 * and the window of operator()() is read ahead from it.
+	 */
 	template<typename Allocator_t>
-	class BaseKernelFile : public BaseKernel<Allocator_t>
+	class BaseKernelFile : public BaseKernel<Allocator_t, KernelStorageFile>
 	{
 	public:
 		BaseKernelFile(
@@ -310,13 +782,21 @@ namespace Convolution
 			const Allocator_t& convDesc,
 			const std::string& kernelName) 
 			: 
-			BaseKernel{nodesCount, convDesc}
+			BaseKernel<Allocator_t, KernelStorageFile>{
+				nodesCount, convDesc, KernelStorageFile{ kernelName } }
 		{}
 
 		void advance()
 		{
 			// you can print here on advance
-			BaseKernel<Allocator_t>::advance();
+			BaseKernel<Allocator_t, KernelStorageFile>::advance();
 		}
 	};
+
+	/**
+	 * @brief Kernel of the reflections in a well,
+	 * F == 1 is neither stored nor multiplied
+	 */
+	template<typename Allocator_t, typename Storage_t = KernelStorageRAM>
+	using ReflectionKernel = BaseKernel<Allocator_t, Storage_t, KernelCoefsUnitF>;
 } // Convolution
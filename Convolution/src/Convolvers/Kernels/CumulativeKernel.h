@@ -0,0 +1,76 @@
+#pragma once
+#include "BaseKernel.h"
+
+namespace Convolution
+{
+	/**
+	 * @brief A kernel whose column block l stores
+	 * the sum of the lag blocks [0; l],
+	 * instead of the lag block l itself.
+	 *
+	 * So, the sum of the lag blocks [a; b)
+	 * is the difference of two column blocks,
+	 * it is used to convolve the kernel with
+	 * the flux averaged over a range of lags.
+	 *
+	 * @tparam Kernel_t The kernel which fills in the
+	 * newest lag block, e.g., WellKernel, FracKernel
+	 */
+	template<
+		template<typename Allocator_t> typename Kernel_t,
+		typename Allocator_t>
+	class CumulativeKernel :
+		public Kernel_t<Allocator_t>
+	{
+	public:
+		using Kernel_t<Allocator_t>::Kernel_t;
+
+		/**
+		 * \brief The newest lag block is calculated by Kernel_t,
+		 * then the previous sum is added to it
+		 */
+		void advance()
+		{
+			const size_t pushed = this->allocator.pusher.pushed_data_counter();
+			Kernel_t<Allocator_t>::advance();
+			// no lag is added beyond the external boundary
+			if (this->allocator.pusher.pushed_data_counter() == pushed)
+				return;
+
+			const Index width = static_cast<Index>(this->block_width());
+			const Index end = static_cast<Index>(this->block_stride_in_row());
+			if (end > width)
+			{
+				this->Kernel.middleCols(end - width, width) +=
+					this->Kernel.middleCols(end - 2 * width, width);
+				// the sum is nonzero within both bands
+				if (this->is_banded())
+					this->row_bands.merge(end - width, end - 2 * width);
+			}
+		}
+
+		/**
+		 * \brief The previous sum is added by advance(),
+		 * so it is not fused with the convolution
+		 */
+		constexpr bool can_fuse_advance() const noexcept
+		{
+			return false;
+		}
+
+		/**
+		 * \brief Sum of the lag blocks [0; lag_end)
+		 * of the window taken by the last operator()() call,
+		 * a Matrix block of size (rows; block_width)
+		 *
+		 * \param lag_end in [1; nmbr of lags in the window]
+		 */
+		auto cumulative(size_t lag_end) const
+		{
+			assert(lag_end > 0);
+			return this->Kernel.middleCols(
+				(lag_end - 1) * this->block_width(),
+				this->block_width());
+		}
+	};
+} // Convolution
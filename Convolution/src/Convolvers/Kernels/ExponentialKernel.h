@@ -0,0 +1,314 @@
+/*****************************************************************//**
+ * \file   ExponentialKernel.h
+ * \brief  The file contains a sum-of-exponentials representation
+ * of the Kernel for the ConstStep regime.
+ *
+ * The Kernel decays smoothly in lag, so the lag response
+ * of a row block is fitted as
+ *		K_l(row, seg) ~ sum_k C_k(row, seg) * lambda_k^(l - J0),
+ *		J0 <= l < frame_temporal_size,
+ * while the J0 most recent lags are kept exact.
+ * Then the convolution of the old lags is
+ *		sum_k C_k * S_k,
+ * where the state S_k is updated recursively at every time step
+ *		S_k = lambda_k * S_k + q[n - J0] - lambda_k^(frame - J0) * q[n - frame],
+ * so the work per step does not depend on the history length.
+ *
+ * The fit is adaptive: the nmbr of exponentials and J0
+ * are increased until the error of the block is below the tolerance.
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * @brief A stateful replacement of
+	 * flux.extract().convolve(kernel) for the ConstStep regime,
+	 * see BlockFFTConvolver for the calling convention.
+	 *
+	 * The Kernel is convolved directly until
+	 * all its frame_temporal_size lags are pushed by advance().
+	 * Then every row block is fitted and
+	 * the recursive update is used.
+	 */
+	class ExponentialKernel
+	{
+	public:
+		/**
+		 * \brief Fit of a row block
+		 */
+		struct RowBlock
+		{
+			Index row_begin;
+			Index row_count;
+			// nmbr of the recent lags kept exact
+			size_t exact_lags;
+			// decay factors, one per exponential
+			VectorXd lambda;
+			// (row_count; term_count * spatial_size),
+			// the col k*spatial_size + seg is C_k(:, seg)
+			MatrixXd coef;
+			// term_count * spatial_size, the states S_k
+			VectorXd state;
+			// lambda^(frame - exact_lags)
+			VectorXd lambda_exit;
+
+			size_t term_count() const noexcept
+			{
+				return static_cast<size_t>(lambda.size());
+			}
+		};
+
+		/**
+		 * \param rows nmbr of mesh points, rows of the Kernel
+		 * \param spatial_size nmbr of segments of the source
+		 * \param frame_temporal_size nmbr of lags in the Kernel
+		 * \param tolerance max error of the fit relative to
+		 * the max abs value of the row block
+		 * \param exact_lags min nmbr of the recent lags kept exact
+		 * \param row_block nmbr of rows fitted together
+		 * \param max_terms max nmbr of exponentials per row block
+		 */
+		ExponentialKernel(
+			size_t rows,
+			size_t spatial_size,
+			size_t frame_temporal_size,
+			double tolerance,
+			size_t exact_lags = 4ull,
+			size_t row_block = 64ull,
+			size_t max_terms = 16ull) :
+			its_rows{ static_cast<Index>(rows) },
+			its_spatial_size{ static_cast<Index>(spatial_size) },
+			frame{ frame_temporal_size },
+			tolerance{ tolerance },
+			min_exact_lags{ (std::max)(exact_lags, size_t{ 1 }) },
+			row_block{ (std::max)(row_block, size_t{ 1 }) },
+			max_terms{ (std::max)(max_terms, size_t{ 1 }) },
+			step{ 0ull },
+			oldest_flux{ VectorXd::Zero(spatial_size) }
+		{}
+
+		bool is_fitted() const noexcept
+		{
+			return !blocks.empty();
+		}
+
+		const std::vector<RowBlock>& row_blocks() const noexcept
+		{
+			return blocks;
+		}
+
+		/**
+		 * \brief Result of convolution at the current time step
+		 * for all mesh points, the same as flux.convolve(kernel)
+		 * but for the extract() of the flux.
+		 */
+		template<typename Kernel_t, typename Flux_t>
+		const VectorXd& convolve(
+			const Kernel_t& kernel,
+			const Flux_t& flux)
+		{
+			const auto window = kernel();
+			const auto flux_window = flux();
+
+			const Index s = its_spatial_size;
+			const size_t lags = static_cast<size_t>(window.cols() / s);
+			if (window.rows() != its_rows ||
+				lags != (std::min)(step + 1, frame) ||
+				flux_window.size() != window.cols())
+				throw std::runtime_error(
+					"ExponentialKernel::convolve() : it must be called once per time step.");
+
+			if (!is_fitted())
+			{
+				result.noalias() = window * flux_window;
+				// all the lags are known
+				if (lags == frame)
+				{
+					fit(window);
+					init_state(flux_window);
+				}
+			}
+			else
+			{
+				result.resize(its_rows);
+				for (auto& rb : blocks)
+				{
+					auto out = result.segment(rb.row_begin, rb.row_count);
+					const Index exact = static_cast<Index>(rb.exact_lags) * s;
+					out.noalias() =
+						window.block(rb.row_begin, 0, rb.row_count, exact) *
+						flux_window.head(exact);
+
+					if (rb.term_count() == 0)
+						continue;
+					const auto entering = flux_window.segment(exact, s);
+					for (Index k = 0; k < rb.lambda.size(); ++k)
+					{
+						auto S = rb.state.segment(k * s, s);
+						S = rb.lambda(k) * S + entering - rb.lambda_exit(k) * oldest_flux;
+					}
+					out.noalias() += rb.coef * rb.state;
+				}
+			}
+
+			// it leaves the window at the next time step
+			oldest_flux = flux_window.tail(s);
+			++step;
+			return result;
+		}
+
+	protected:
+		/**
+		 * \brief Decay factors of term_count exponentials
+		 * with time scales log-spaced in [0.5; 2*frame] steps
+		 */
+		VectorXd decay_grid(size_t term_count) const
+		{
+			const double tau_min = 0.5;
+			const double tau_max = 2.0 * static_cast<double>(frame);
+			VectorXd lambda(static_cast<Index>(term_count));
+			for (size_t k = 0; k < term_count; ++k)
+			{
+				const double ratio = term_count > 1 ?
+					static_cast<double>(k) / static_cast<double>(term_count - 1) :
+					0.5;
+				lambda(static_cast<Index>(k)) = std::exp(
+					-1.0 / (tau_min * std::pow(tau_max / tau_min, ratio)));
+			}
+			return lambda;
+		}
+
+		/**
+		 * \brief Least squares fit of every row block.
+		 * The candidates (exact_lags; term_count) are tried
+		 * in the order of the work per step, exact_lags + term_count,
+		 * the first one within the tolerance is taken.
+		 * A block without such a candidate is kept exact.
+		 */
+		template<typename Window>
+		void fit(const Window& window)
+		{
+			struct Candidate
+			{
+				size_t exact_lags;
+				size_t term_count;
+			};
+			std::vector<Candidate> candidates;
+			for (size_t exact = min_exact_lags; exact < frame; exact *= 2)
+				for (size_t terms = 1; terms <= max_terms; terms *= 2)
+					if (terms < frame - exact)
+						candidates.push_back({ exact, terms });
+			std::stable_sort(candidates.begin(), candidates.end(),
+				[](const Candidate& a, const Candidate& b)
+				{
+					return a.exact_lags + a.term_count < b.exact_lags + b.term_count;
+				});
+
+			const Index s = its_spatial_size;
+			for (Index row = 0; row < its_rows; row += static_cast<Index>(row_block))
+			{
+				RowBlock rb;
+				rb.row_begin = row;
+				rb.row_count = (std::min)(static_cast<Index>(row_block), its_rows - row);
+				rb.exact_lags = frame;
+				blocks.push_back(std::move(rb));
+			}
+
+			std::vector<bool> is_done(blocks.size(), false);
+			for (const auto& candidate : candidates)
+			{
+				const Index tail = static_cast<Index>(frame - candidate.exact_lags);
+				const VectorXd lambda = decay_grid(candidate.term_count);
+				MatrixXd basis(tail, lambda.size());
+				for (Index k = 0; k < lambda.size(); ++k)
+					for (Index l = 0; l < tail; ++l)
+						basis(l, k) = std::pow(lambda(k), static_cast<double>(l));
+				const ColPivHouseholderQR<MatrixXd> qr{ basis };
+
+				for (size_t block_id = 0; block_id < blocks.size(); ++block_id)
+				{
+					if (is_done[block_id])
+						continue;
+					RowBlock& rb = blocks[block_id];
+					MatrixXd coef(rb.row_count, lambda.size() * s);
+					double error = 0.0;
+					double scale = 0.0;
+					for (Index seg = 0; seg < s; ++seg)
+					{
+						// (tail; row_count), the lag response of the segment
+						MatrixXd target(tail, rb.row_count);
+						for (Index l = 0; l < tail; ++l)
+							target.row(l) = window.block(
+								rb.row_begin,
+								(static_cast<Index>(candidate.exact_lags) + l) * s + seg,
+								rb.row_count, 1).transpose();
+						const MatrixXd solution = qr.solve(target);
+						error = (std::max)(error,
+							(basis * solution - target).cwiseAbs().maxCoeff());
+						scale = (std::max)(scale, target.cwiseAbs().maxCoeff());
+						for (Index k = 0; k < lambda.size(); ++k)
+							coef.col(k * s + seg) = solution.row(k).transpose();
+					}
+					// the exact lags are compared to the whole block
+					scale = (std::max)(scale, window.middleRows(rb.row_begin, rb.row_count)
+						.cwiseAbs().maxCoeff());
+					if (error > tolerance * scale)
+						continue;
+
+					is_done[block_id] = true;
+					rb.exact_lags = candidate.exact_lags;
+					rb.lambda = lambda;
+					rb.coef = std::move(coef);
+					rb.lambda_exit = lambda.array().pow(static_cast<double>(tail)).matrix();
+				}
+			}
+		}
+
+		/**
+		 * \brief States of the old lags at the time step of the fit
+		 */
+		template<typename FluxWindow>
+		void init_state(const FluxWindow& flux_window)
+		{
+			const Index s = its_spatial_size;
+			for (auto& rb : blocks)
+			{
+				rb.state = VectorXd::Zero(rb.lambda.size() * s);
+				for (size_t lag = rb.exact_lags; lag < frame; ++lag)
+					for (Index k = 0; k < rb.lambda.size(); ++k)
+						rb.state.segment(k * s, s) +=
+							std::pow(rb.lambda(k), static_cast<double>(lag - rb.exact_lags)) *
+							flux_window.segment(static_cast<Index>(lag) * s, s);
+			}
+		}
+
+	protected:
+		const Index its_rows;
+		const Index its_spatial_size;
+		const size_t frame;
+		const double tolerance;
+		const size_t min_exact_lags;
+		const size_t row_block;
+		const size_t max_terms;
+
+		// the current time step, from 0
+		size_t step;
+		std::vector<RowBlock> blocks;
+		// the flux of the oldest lag at the previous time step
+		VectorXd oldest_flux;
+		VectorXd result;
+	};
+} // Convolution
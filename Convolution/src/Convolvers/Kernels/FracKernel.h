@@ -1,5 +1,7 @@
 #pragma once
 #include "BaseKernel.h"
+#include "KernelCache.h"
+#include "../Engines/ThreadPool.h"
 
 namespace Convolution
 {
@@ -8,37 +10,119 @@ namespace Convolution
 	 * fracture-related kernel, 
 	 * which stores coefs R and U and
 	 * calculates the sum(R*(U-U)).
+	 *
+	 * @tparam Storage_t Policy which allocates the Kernel matrix,
+	 * e.g., KernelStorageFloat keeps the sum in float,
+	 * while every term R*(U-U) is computed in double.
+	 * F is not stored, see KernelCoefsFrac.
 	 */
-	template<typename Allocator_t>
-	class FracKernel :
-		public BaseKernel<Allocator_t/*=KernelConstStep*/>
+	template<
+		typename Allocator_t,
+		typename Storage_t = KernelStorageRAM>
+	class BasicFracKernel :
+		public BaseKernel<Allocator_t/*=KernelConstStep*/, Storage_t, KernelCoefsFrac>
 	{
 	public:
-		FracKernel(
+		BasicFracKernel(
 			size_t nodesCount,
-			const typename KernelTypedefs<Allocator_t>::Allocator& convDesc) :
-			BaseKernel{
-			nodesCount, convDesc }
-		{}
+			const typename KernelTypedefs<Allocator_t>::Allocator& convDesc,
+			const Storage_t& storage = Storage_t{}) :
+			BaseKernel<Allocator_t, Storage_t, KernelCoefsFrac>{
+			nodesCount, convDesc, storage }
+		{
+			// the terms are added to the Kernel
+			set_zero_lags();
+		}
 
-		using BaseKernel<Allocator_t>::push_coef;
+		using BaseKernel<Allocator_t, Storage_t, KernelCoefsFrac>::push_coef;
 		void push_coef(
 			const double* R_data, const double* U_data)
 		{
-			//		F.colwise() = ArrayXd::Map(R_data, block_height());
-					// P_cur should be filled in in-place
-					// now, it is copied, which is not optimal
+			// U is copied, use coef_writer() and commit_coef()
+			// to fill in P_cur in place
 			P_cur = ArrayXXd::Map(U_data, block_height(), block_width());
+			commit_coef(R_data);
+		}
+
+		/**
+		 * \brief The term R*(U-U) is added to the Kernel,
+		 * where U has been written to P_cur in place,
+		 * see BaseKernel::coef_writer(), so no copy of U is made.
+		 * P_cur and P_prev are swapped instead,
+		 * so a CoefWriter is stale after commit_coef():
+		 * coef_writer() is called again before the next term.
+		 *
+		 * \param R_data R-coefs, block_height() values
+		 */
+		void commit_coef(const double* R_data)
+		{
+			if (external_boundary)
+			{
+				// the lags beyond the external boundary are not stored
+				P_prev.swap(P_cur);
+				return;
+			}
 			// calculate a new block and ADD it to Kernel,
 			// at appropriate positions
-			Kernel.middleCols(
-				block_stride_in_row(), block_width()) +=
+			auto block = lag_block(block_stride_in_row());
+			store_block(block,
+				block.template cast<double>() +
 				(
 					(P_cur - P_prev).colwise() *
 					ArrayXd::Map(R_data, block_height())
-				).matrix();
+				).matrix());
+
+			// the memory of P_prev is reused
+			// by P_cur at the next push_coef()
+			P_prev.swap(P_cur);
+
+#ifdef PUSHER_ADVANCE_FLAG
+			allocator.pusher.need_advance = true;
+#endif
+		}
 
-			P_prev = std::move(P_cur);
+		/**
+		 * \brief The terms R_k*(U_k - U_{k-1}), k in [0; term_count),
+		 * are added to the Kernel as by term_count calls of push_coef(),
+		 * where U_{-1} is P_prev. The block is read and written once:
+		 * a tile of its rows is kept in the cache while all the terms
+		 * are added to it. No U is copied but the last one,
+		 * which becomes P_prev.
+		 *
+		 * \param R_data R-coefs per term, block_height() values each
+		 * \param U_data U-coefs per term, (block_height(); block_width()) each
+		 */
+		void push_coefs(
+			const double* const* R_data,
+			const double* const* U_data,
+			size_t term_count)
+		{
+			if (term_count == 0)
+				return;
+			const Index rows = static_cast<Index>(block_height());
+			const Index cols = static_cast<Index>(block_width());
+			if (!external_boundary)
+			{
+				auto block = lag_block(block_stride_in_row());
+				for (Index col = 0; col < cols; ++col)
+					for (Index row = 0; row < rows; row += batch_tile_rows)
+					{
+						const Index count = (std::min)(batch_tile_rows, rows - row);
+						const Index offset = col * rows + row;
+						auto tile = batch_tile.head(count);
+						tile = block.col(col).segment(row, count).template cast<double>().array();
+						const double* prev = P_prev.data() + offset;
+						for (size_t term = 0; term < term_count; ++term)
+						{
+							const double* cur = U_data[term] + offset;
+							tile += (ArrayXd::Map(cur, count) - ArrayXd::Map(prev, count)) *
+								ArrayXd::Map(R_data[term] + row, count);
+							prev = cur;
+						}
+						store_block(block.col(col).segment(row, count), tile.matrix());
+					}
+			}
+			P_prev = ArrayXXd::Map(U_data[term_count - 1], rows, cols);
 
 #ifdef PUSHER_ADVANCE_FLAG
 			allocator.pusher.need_advance = true;
@@ -60,30 +144,83 @@ namespace Convolution
 
 		void advance()
 		{
+			// the sum of all the terms of the block is checked
+			if (!external_boundary)
+				check_external_boundary(lag_block(block_stride_in_row()));
+			if (external_boundary)
+				return;
+			record_row_band(static_cast<Index>(block_stride_in_row()));
 			// prepare the initial state for the next time moment
 			on_advance();
 		}
 		void reset_kernel()
 		{
 			// prepare the initial state for the next time moment
-			Kernel = MatrixXd::Zero(Kernel.rows(), Kernel.cols());
+			set_zero_lags();
+			row_bands.reset();
+		}
+
+		/**
+		 * \brief The block is summed up by push_coef(),
+		 * so advance() is not fused with the convolution
+		 */
+		constexpr bool can_fuse_advance() const noexcept
+		{
+			return false;
 		}
+
+	private:
+		// nmbr of rows of a tile of push_coefs()
+		static constexpr Index batch_tile_rows{ 2048 };
+		// the tile in double, it is reused by every push_coefs()
+		ArrayXd batch_tile = ArrayXd(batch_tile_rows);
 	};
 
+	template<typename Allocator_t>
+	using FracKernel = BasicFracKernel<Allocator_t, KernelStorageRAM>;
+
+	/**
+	 * @brief Fracture kernel stored in float,
+	 * to be passed to FracKernelContainer
+	 */
+	template<typename Allocator_t>
+	using FracKernelFloat = BasicFracKernel<Allocator_t, KernelStorageFloat>;
+
+	/**
+	 * @brief Fracture kernel stored in the matrix
+	 * of PackedFracKernelContainer
+	 */
+	template<typename Allocator_t>
+	using PackedFracKernel = BasicFracKernel<Allocator_t, KernelStoragePacked>;
+
 	/**
 	 * @brief Container class for a set of 
 	 * fracture-related kernels.
 	 * 
 	 * An object of such class corresponds to a 
 	 * single group of nodes and multiple fractures.
+	 * 
+	 * @tparam Kernel_t Kernel of a fracture, 
+	 * FracKernel or a kernel derived from it
 	 */
-	template<typename Allocator_t>
+	template<
+		typename Allocator_t,
+		template<typename Allocator_t> typename Kernel_t = FracKernel>
 	class FracKernelContainer :
 		public KernelTypedefs<Allocator_t>,
-		public MultipleFracturesContainer<FracKernel<Allocator_t>>
+		public MultipleFracturesContainer<Kernel_t<Allocator_t>>
 	{
 		// current time index
 		size_t nt;
+	protected:
+		/**
+		 * \brief The kernels are emplaced by a derived container
+		 */
+		explicit FracKernelContainer(size_t fracCount) :
+			MultipleFracturesContainer<
+			Kernel_t<Allocator_t>>{ fracCount },
+			nt{ 0 }
+		{}
 	public:
 		FracKernelContainer() = default;
 
@@ -93,7 +230,7 @@ namespace Convolution
 			vec_convDesc,
 			size_t nodesCount) :
 			MultipleFracturesContainer<
-			FracKernel<Allocator_t>>{
+			Kernel_t<Allocator_t>>{
 			vec_convDesc.size()
 		},
 			nt{ 0 }
@@ -114,6 +251,41 @@ namespace Convolution
 			data[cur_frac_id].push_coef(R_data, U_data); // push to the current fracture
 			this->on_push_coef(); // advance to the next fracture in container in a closed loop
 		}
+
+		/**
+		 * \brief Several terms are pushed to the current fracture
+		 * in a single pass, see BasicFracKernel::push_coefs()
+		 */
+		void push_coefs(
+			const double* const* R_data,
+			const double* const* U_data,
+			size_t term_count)
+		{
+			data[cur_frac_id].push_coefs(R_data, U_data, term_count);
+			this->on_push_coef();
+		}
+
+		/**
+		 * \brief Views to write U of the current fracture in place,
+		 * see BaseKernel::coef_writer().
+		 * They are fetched again after every commit_coef(),
+		 * which swaps the memory of P_cur and P_prev
+		 */
+		auto coef_writer()
+		{
+			return data[cur_frac_id].coef_writer();
+		}
+
+		/**
+		 * \brief Replaces push_coef() once U is written
+		 * through coef_writer()
+		 */
+		void commit_coef(
+			const double* R_data)
+		{
+			data[cur_frac_id].commit_coef(R_data); // push to the current fracture
+			this->on_push_coef(); // advance to the next fracture in container in a closed loop
+		}
 		void push_coef_prev(
 			const double* U_data)
 		{
@@ -125,10 +297,86 @@ namespace Convolution
 			data[cur_frac_id].reset_kernel();
 		}
 
+		/**
+		 * \brief The indexed push: the methods below take
+		 * the fracture id instead of the round-robin cursor.
+		 * They may be called concurrently for distinct fractures,
+		 * and in any order of the fractures.
+		 * Every fracture must be pushed and push_done(frac_id) called
+		 * before advance(), see push_barrier().
+		 */
+		void push_coef(
+			size_t frac_id,
+			const double* R_data,
+			const double* U_data)
+		{
+			data[frac_id].push_coef(R_data, U_data);
+		}
+
+		void push_coefs(
+			size_t frac_id,
+			const double* const* R_data,
+			const double* const* U_data,
+			size_t term_count)
+		{
+			data[frac_id].push_coefs(R_data, U_data, term_count);
+		}
+
+		/**
+		 * \brief Views to write U of the fracture frac_id in place,
+		 * valid until its next commit_coef(), see coef_writer()
+		 */
+		auto coef_writer(size_t frac_id)
+		{
+			return data[frac_id].coef_writer();
+		}
+
+		void commit_coef(
+			size_t frac_id,
+			const double* R_data)
+		{
+			data[frac_id].commit_coef(R_data);
+		}
+
+		void push_coef_prev(
+			size_t frac_id,
+			const double* U_data)
+		{
+			data[frac_id].push_coef_prev(U_data);
+		}
+
+		void reset_kernel(size_t frac_id) noexcept
+		{
+			data[frac_id].reset_kernel();
+		}
+
+		/**
+		 * \brief Pushing to the fracture is done
+		 */
+		void push_done(size_t frac_id)
+		{
+			this->on_push_done(frac_id);
+		}
+
+		/**
+		 * \brief The kernels of the fractures are advanced
+		 * concurrently with POOL_CODE, once every fracture is pushed
+		 */
 		void advance()
 		{
+			if (!this->push_barrier("FracKernelContainer::advance()"))
+				throw std::runtime_error(
+					"FracKernelContainer::advance() : the fractures are advanced twice without a push. Cannot proceed safely.");
+#ifdef POOL_CODE
+			ThreadPool::instance().parallel_for(data.size(),
+				[this](size_t frac_id)
+				{
+					data[frac_id].advance();
+				});
+#else
 			for (auto& k : data)
 				k.advance();
+#endif
 #ifdef PUSHER_ADVANCE_FLAG
 			need_advance = false;
 #endif
@@ -151,10 +399,50 @@ namespace Convolution
 		*/
 		void push_done()
 		{
+			this->on_push_done(cur_frac_id);
 			++nt;
 			cur_frac_id = (1 + cur_frac_id) % frac_count; // advance to the next fracture in container in a closed loop
 		}
 
+		/**
+		 * \brief The kernels of all the fractures are saved,
+		 * the key of a fracture is key.part(frac_id)
+		 */
+		void save(
+			const KernelCache& cache,
+			const KernelCacheKey& key) const
+		{
+			for (size_t frac = 0; frac < data.size(); ++frac)
+				cache.save(key.part(frac), data[frac]);
+		}
+
+		/**
+		 * \brief The kernels of all the fractures are loaded,
+		 * if the cache contains all of them
+		 *
+		 * \return false if no kernel is loaded
+		 */
+		bool load(
+			const KernelCache& cache,
+			const KernelCacheKey& key)
+		{
+			for (size_t frac = 0; frac < data.size(); ++frac)
+				if (!cache.contains(key.part(frac)))
+					return false;
+			for (size_t frac = 0; frac < data.size(); ++frac)
+				if (!cache.load(key.part(frac), data[frac]))
+					throw std::runtime_error(
+						"FracKernelContainer::load() : a fracture kernel does not fit the cache.");
+			return true;
+		}
+
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			MultipleFracturesContainer<Kernel_t<Allocator_t>>::checkpoint(visitor);
+			visitor.pod(nt);
+		}
+
 		double Irs(
 			size_t frac_id, size_t frac_node,
 			size_t l, size_t nt) const
@@ -162,4 +450,91 @@ namespace Convolution
 			return data[frac_id](l, frac_node, nt);
 		}
 	};
+
+	/**
+	 * @brief FracKernelContainer whose kernels are stored
+	 * in a single matrix, packed_kernel(), lag by lag:
+	 * the lag block l of every fracture, one fracture after another,
+	 * is in the cols [l * lag_width(); (l + 1) * lag_width()),
+	 * see KernelStoragePacked.
+	 * The flux windows of the fractures are packed the same way,
+	 * see FracturesFluxContainer_t::convolve(),
+	 * so the sum of the convolutions over the fractures
+	 * is a single product of the matrix and the vector,
+	 * and only the lags within the windows are multiplied.
+	 *
+	 * The kernels refer to the matrix, so the container is not copied.
+	 */
+	template<typename Allocator_t>
+	class PackedFracKernelContainer :
+		public FracKernelContainer<Allocator_t, PackedFracKernel>
+	{
+		MatrixXd packed;
+		// the first col of every fracture within a lag
+		std::vector<Index> offsets;
+		// nmbr of cols of a lag of all the fractures
+		Index lag_cols;
+	public:
+		PackedFracKernelContainer(
+			const std::vector<typename
+			KernelTypedefs<Allocator_t>::Allocator>&
+			vec_convDesc,
+			size_t nodesCount) :
+			FracKernelContainer<Allocator_t, PackedFracKernel>{
+				vec_convDesc.size() },
+			lag_cols{ 0 }
+		{
+			Index lags = 0;
+			offsets.reserve(vec_convDesc.size());
+			for (const auto& convDesc : vec_convDesc)
+			{
+				const Index width = static_cast<Index>(convDesc.pusher.spatial_size());
+				offsets.push_back(lag_cols);
+				lag_cols += width;
+				lags = (std::max)(lags,
+					static_cast<Index>(convDesc.pusher.allocated_memory()) / width);
+			}
+			// the cols which are not written yet are zero
+			packed = MatrixXd::Zero(static_cast<Index>(nodesCount), lags * lag_cols);
+			for (size_t frac = 0; frac < vec_convDesc.size(); ++frac)
+				this->data.emplace_back(
+					nodesCount,
+					vec_convDesc[frac],
+					KernelStoragePacked{
+						packed.data() + offsets[frac] * packed.rows(),
+						lag_cols,
+						static_cast<Index>(vec_convDesc[frac].pusher.spatial_size()) });
+		}
+
+		PackedFracKernelContainer(const PackedFracKernelContainer&) = delete;
+		PackedFracKernelContainer& operator=(const PackedFracKernelContainer&) = delete;
+		// the memory of the matrix and the kernels is moved as it is
+		PackedFracKernelContainer(PackedFracKernelContainer&&) = default;
+
+		/**
+		 * \brief The kernels of all the fractures,
+		 * size: nodesCount BY the max nmbr of lags times lag_width()
+		 */
+		const MatrixXd& packed_kernel() const noexcept
+		{
+			return packed;
+		}
+
+		/**
+		 * \brief Nmbr of cols of a lag of all the fractures
+		 */
+		Index lag_width() const noexcept
+		{
+			return lag_cols;
+		}
+
+		/**
+		 * \brief The first col of the fracture kernel
+		 * within a lag of packed_kernel()
+		 */
+		Index col_offset(size_t frac_id) const
+		{
+			return offsets[frac_id];
+		}
+	};
 } // Convolution
@@ -0,0 +1,238 @@
+/*****************************************************************//**
+ * \file   KernelBands.h
+ * \brief  The file contains the row bands of the lag blocks
+ * of a kernel.
+ *
+ * At the early lags the pressure change reaches only
+ * the mesh nodes close to the sources, so most rows
+ * of a lag block are (almost) zero.
+ * Once a block is written by advance(), the contiguous
+ * range of its rows above a threshold is recorded,
+ * the rows beyond it are set to zero, and the convolution
+ * multiplies only the recorded ranges, see BandedEngine.
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#include <Eigen/Core>
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * @brief Rows [begin; begin + count) of a lag block
+	 */
+	struct RowBand
+	{
+		Index begin;
+		Index count;
+	};
+
+	/**
+	 * @brief Part of a kernel window convolved
+	 * as a dense block: the cols [col_begin; col_begin + col_count)
+	 * of the window and the rows [row_begin; row_begin + row_count)
+	 */
+	struct BandedBlock
+	{
+		Index col_begin;
+		Index col_count;
+		Index row_begin;
+		Index row_count;
+	};
+
+	/**
+	 * @brief Row bands of the lag blocks of a kernel,
+	 * a band per block of block_width columns of the Kernel
+	 */
+	class KernelBands
+	{
+	public:
+		// the zero rows the convolution of a merged
+		// group may multiply, relative to its nonzero rows
+		static constexpr double merge_slack{ 0.25 };
+
+		KernelBands() = default;
+
+		/**
+		 * \param block_count nmbr of lag blocks in the Kernel
+		 * \param block_width nmbr of cols in a block
+		 * \param tolerance the rows whose max coefficient
+		 * is not above tolerance * max coefficient of the block
+		 * are dropped, 0 drops only the zero rows
+		 */
+		KernelBands(size_t block_count, Index block_width, double tolerance) :
+			bands(block_count, RowBand{ 0, 0 }),
+			width{ block_width },
+			its_tolerance{ tolerance }
+		{}
+
+		bool empty() const noexcept
+		{
+			return bands.empty();
+		}
+
+		double tolerance() const noexcept
+		{
+			return its_tolerance;
+		}
+
+		const RowBand& band(size_t block_id) const
+		{
+			return bands[block_id];
+		}
+
+		RowBand* data() noexcept
+		{
+			return bands.data();
+		}
+
+		size_t size() const noexcept
+		{
+			return bands.size();
+		}
+
+		/**
+		 * \brief The band of a block just written to the Kernel
+		 * is found, and the rows beyond it are set to zero
+		 *
+		 * \param block Cols [col; col + width) of the Kernel
+		 * \param col The first col of the block
+		 */
+		template<typename Block>
+		void record(Block&& block, Index col)
+		{
+			using Scalar = typename std::decay_t<Block>::Scalar;
+			const Index rows = block.rows();
+			row_max =
+				block.template cast<double>().cwiseAbs().rowwise().maxCoeff().array();
+			const double threshold = its_tolerance * row_max.maxCoeff();
+
+			Index begin = 0;
+			while (begin < rows && !(row_max(begin) > threshold))
+				++begin;
+			Index end = rows;
+			while (end > begin && !(row_max(end - 1) > threshold))
+				--end;
+
+			block.topRows(begin).setConstant(Scalar(0));
+			block.bottomRows(rows - end).setConstant(Scalar(0));
+			bands[static_cast<size_t>(col / width)] = RowBand{ begin, end - begin };
+			++version;
+		}
+
+		/**
+		 * \brief The band of a block becomes the union
+		 * of its band and the band of another block,
+		 * e.g., once the block is summed with it
+		 */
+		void merge(Index col, Index other_col)
+		{
+			RowBand& target = bands[static_cast<size_t>(col / width)];
+			target = unite(target, bands[static_cast<size_t>(other_col / width)]);
+			++version;
+		}
+
+		void reset() noexcept
+		{
+			std::fill(bands.begin(), bands.end(), RowBand{ 0, 0 });
+			++version;
+		}
+
+		/**
+		 * \brief The bands are changed from outside, e.g., restored
+		 * from a checkpoint through data()
+		 */
+		void touch() noexcept
+		{
+			++version;
+		}
+
+		/**
+		 * \brief The window [col_begin; col_begin + col_count)
+		 * of the Kernel is split into the groups of consecutive blocks
+		 * which are convolved as dense blocks.
+		 * The neighbouring blocks are merged while the zero rows
+		 * multiplied within a group do not exceed merge_slack
+		 * of its nonzero rows, the zero blocks are skipped.
+		 *
+		 * \return The groups, the cols are relative to col_begin
+		 */
+		const std::vector<BandedBlock>& groups(Index col_begin, Index col_count) const
+		{
+			if (col_begin == groups_col_begin &&
+				col_count == groups_col_count &&
+				version == groups_version)
+				return its_groups;
+
+			its_groups.clear();
+			// nonzero work of the current group
+			double work = 0.0;
+			for (Index col = 0; col < col_count; col += width)
+			{
+				const Index cols = (std::min)(width, col_count - col);
+				const RowBand& next = bands[static_cast<size_t>((col_begin + col) / width)];
+				if (next.count == 0)
+					continue;
+
+				const double next_work = static_cast<double>(next.count * cols);
+				if (!its_groups.empty())
+				{
+					BandedBlock& last = its_groups.back();
+					const RowBand merged = unite(
+						RowBand{ last.row_begin, last.row_count }, next);
+					const Index merged_cols = col + cols - last.col_begin;
+					if (static_cast<double>(merged.count * merged_cols) <=
+						(1.0 + merge_slack) * (work + next_work))
+					{
+						last.col_count = merged_cols;
+						last.row_begin = merged.begin;
+						last.row_count = merged.count;
+						work += next_work;
+						continue;
+					}
+				}
+				its_groups.push_back(BandedBlock{ col, cols, next.begin, next.count });
+				work = next_work;
+			}
+
+			groups_col_begin = col_begin;
+			groups_col_count = col_count;
+			groups_version = version;
+			return its_groups;
+		}
+
+	private:
+		std::vector<RowBand> bands;
+		Index width{ 1 };
+		double its_tolerance{ 0.0 };
+		// changed on every update of the bands
+		size_t version{ 0ull };
+		// max coefficient per row of the recorded block,
+		// it is reused by every record()
+		ArrayXd row_max;
+
+		// the groups of the last window
+		mutable std::vector<BandedBlock> its_groups;
+		mutable Index groups_col_begin{ -1 };
+		mutable Index groups_col_count{ -1 };
+		mutable size_t groups_version{ 0ull };
+
+		static RowBand unite(const RowBand& a, const RowBand& b) noexcept
+		{
+			if (a.count == 0)
+				return b;
+			if (b.count == 0)
+				return a;
+			const Index begin = (std::min)(a.begin, b.begin);
+			const Index end = (std::max)(a.begin + a.count, b.begin + b.count);
+			return RowBand{ begin, end - begin };
+		}
+	};
+} // Convolution
@@ -0,0 +1,369 @@
+/*****************************************************************//**
+ * \file   KernelCache.h
+ * \brief  The file contains a persistent cache of kernels.
+ *
+ * A kernel depends only on the mesh, the source geometry
+ * and the time steps, not on the rates. So, once it is built
+ * by push_source/advance, its Kernel columns and P_prev
+ * are saved in a binary file named after a hash of
+ * the construction parameters, see KernelCacheKey,
+ * and the later runs load them instead of building.
+ *
+ * The file is a header padded to a page,
+ * the whole Kernel matrix (ColMajor, in its storage precision)
+ * and P_prev (double). The entry is read into the storage
+ * of the kernel, so a kernel in a MappedMatrix
+ * (BaseKernelFile, WellKernelFile) stays in its own scratch file
+ * and it may exceed the RAM.
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "BaseKernel.h"
+
+namespace Convolution
+{
+	/**
+	 * @brief Tag of a stored scalar type.
+	 * The width does not identify the type:
+	 * Eigen::bfloat16 and Eigen::half are both 2 bytes.
+	 * A type without a tag cannot be cached.
+	 */
+	template<typename Scalar_t>
+	struct KernelScalarTag;
+
+	template<>
+	struct KernelScalarTag<double>
+	{
+		static constexpr std::uint64_t value{ 1ull };
+	};
+
+	template<>
+	struct KernelScalarTag<float>
+	{
+		static constexpr std::uint64_t value{ 2ull };
+	};
+
+	template<>
+	struct KernelScalarTag<Eigen::bfloat16>
+	{
+		static constexpr std::uint64_t value{ 3ull };
+	};
+
+	template<>
+	struct KernelScalarTag<Eigen::half>
+	{
+		static constexpr std::uint64_t value{ 4ull };
+	};
+
+	/**
+	 * @brief 64-bit FNV-1a hash of the parameters
+	 * the kernel is constructed from:
+	 * the kernel shape, the time steps,
+	 * and a geometry key supplied by the caller
+	 * (mesh, source coordinates, permeability etc.).
+	 */
+	class KernelCacheKey
+	{
+	public:
+		explicit KernelCacheKey(const std::string& kernelName = "Kernel")
+		{
+			add(kernelName);
+		}
+
+		/**
+		 * \brief Key of a kernel of a given shape
+		 *
+		 * \param geometry_key Identifies the mesh and the sources
+		 * \param time_steps Sizes of the time steps the kernel is built at
+		 */
+		template<typename Allocator_t, typename Storage_t, typename Coefs_t>
+		static KernelCacheKey of(
+			const std::string& kernelName,
+			const BaseKernel<Allocator_t, Storage_t, Coefs_t>& kernel,
+			const std::string& geometry_key,
+			const std::vector<double>& time_steps)
+		{
+			KernelCacheKey key{ kernelName };
+			key.add(kernel.rows())
+				.add(kernel.allocator.pusher)
+				.add(static_cast<size_t>(KernelScalarTag<typename Storage_t::Scalar>::value))
+				.add(geometry_key)
+				.add(time_steps);
+			return key;
+		}
+
+		KernelCacheKey& add(const void* bytes, size_t count) noexcept
+		{
+			const unsigned char* data = static_cast<const unsigned char*>(bytes);
+			for (size_t i = 0; i < count; ++i)
+			{
+				hash ^= data[i];
+				hash *= 1099511628211ull;
+			}
+			return *this;
+		}
+
+		KernelCacheKey& add(size_t value) noexcept
+		{
+			const std::uint64_t fixed = static_cast<std::uint64_t>(value);
+			return add(&fixed, sizeof(fixed));
+		}
+
+		KernelCacheKey& add(double value) noexcept
+		{
+			return add(&value, sizeof(value));
+		}
+
+		KernelCacheKey& add(const std::string& value) noexcept
+		{
+			// the size separates the consecutive strings
+			add(value.size());
+			return add(value.data(), value.size());
+		}
+
+		KernelCacheKey& add(const std::vector<double>& values) noexcept
+		{
+			add(values.size());
+			return add(values.data(), values.size() * sizeof(double));
+		}
+
+		KernelCacheKey& add(const MemoryDesc& memoryDesc) noexcept
+		{
+			add(memoryDesc.spatial_size());
+			return add(memoryDesc.temporal_size());
+		}
+
+		/**
+		 * \brief Key of a part, e.g., a fracture of a container
+		 */
+		KernelCacheKey part(size_t part_id) const noexcept
+		{
+			KernelCacheKey key{ *this };
+			key.add(part_id);
+			return key;
+		}
+
+		std::uint64_t value() const noexcept
+		{
+			return hash;
+		}
+
+		/**
+		 * \brief 16 hex digits
+		 */
+		std::string name() const
+		{
+			static const char digits[] = "0123456789abcdef";
+			std::string out(16, '0');
+			for (size_t i = 0; i < 16; ++i)
+				out[15 - i] = digits[(hash >> (4 * i)) & 0xFull];
+			return out;
+		}
+
+	private:
+		std::uint64_t hash{ 14695981039346656037ull };
+	};
+
+	/**
+	 * @brief Directory of kernel files, a file per key.
+	 */
+	class KernelCache
+	{
+	public:
+		// the data starts at a page, so it can be mapped
+		static constexpr size_t header_bytes{ 4096 };
+
+		explicit KernelCache(std::string directory) :
+			its_directory{ std::move(directory) }
+		{}
+
+		const std::string& directory() const noexcept
+		{
+			return its_directory;
+		}
+
+		std::string path(const KernelCacheKey& key) const
+		{
+			return its_directory + "/" + key.name() + ".kernel";
+		}
+
+		bool contains(const KernelCacheKey& key) const
+		{
+			std::error_code error;
+			return std::filesystem::is_regular_file(path(key), error);
+		}
+
+		/**
+		 * \brief The kernel is written to a temporary file
+		 * which replaces the entry at once,
+		 * so a concurrent run never reads a partial entry
+		 */
+		template<typename Allocator_t, typename Storage_t, typename Coefs_t>
+		void save(
+			const KernelCacheKey& key,
+			const BaseKernel<Allocator_t, Storage_t, Coefs_t>& kernel) const
+		{
+			using Scalar = typename Storage_t::Scalar;
+			static_assert(Storage_t::contiguous_lags,
+				"KernelCache::save() : the lags of the storage are not contiguous.");
+			kernel.is_correct_state();
+
+			const Header header{
+				key,
+				static_cast<std::uint64_t>(kernel.Kernel.rows()),
+				static_cast<std::uint64_t>(kernel.stored_cols()),
+				static_cast<std::uint64_t>(kernel.allocator.pusher.pushed_data_counter()),
+				static_cast<std::uint64_t>(kernel.block_width()),
+				KernelScalarTag<Scalar>::value,
+				static_cast<std::uint64_t>(sizeof(Scalar)) };
+
+			std::filesystem::create_directories(its_directory);
+			const std::string target = path(key);
+			const std::string scratch = target + "." + random_suffix();
+			{
+				std::ofstream out{ scratch, std::ios::binary | std::ios::trunc };
+				std::vector<char> page(header_bytes, '\0');
+				std::memcpy(page.data(), &header, sizeof(header));
+				out.write(page.data(), page.size());
+				out.write(
+					reinterpret_cast<const char*>(kernel.Kernel.data()),
+					static_cast<std::streamsize>(header.kernel_bytes()));
+				out.write(
+					reinterpret_cast<const char*>(kernel.get_P_prev().data()),
+					static_cast<std::streamsize>(header.p_bytes()));
+				if (!out)
+				{
+					out.close();
+					std::filesystem::remove(scratch);
+					throw std::runtime_error("KernelCache::save() : the file cannot be written: " + scratch);
+				}
+			}
+			std::filesystem::rename(scratch, target);
+		}
+
+		/**
+		 * \brief The kernel must be just constructed.
+		 * If the entry exists and it fits the kernel,
+		 * the kernel is loaded and advanced as it was saved.
+		 *
+		 * \return false if there is no entry for the key,
+		 * then the kernel is to be built and saved
+		 */
+		template<typename Allocator_t, typename Storage_t, typename Coefs_t>
+		bool load(
+			const KernelCacheKey& key,
+			BaseKernel<Allocator_t, Storage_t, Coefs_t>& kernel) const
+		{
+			using Scalar = typename Storage_t::Scalar;
+			static_assert(Storage_t::contiguous_lags,
+				"KernelCache::load() : the lags of the storage are not contiguous.");
+			if (!contains(key))
+				return false;
+
+			std::ifstream in{ path(key), std::ios::binary };
+			Header header;
+			if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+				return false;
+			// a stale entry or a collision of the hash
+			// is built again
+			std::error_code error;
+			if (!header.fits(key, kernel, KernelScalarTag<Scalar>::value, sizeof(Scalar)) ||
+				std::filesystem::file_size(path(key), error) !=
+				header_bytes + header.kernel_bytes() + header.p_bytes())
+				return false;
+
+			in.seekg(static_cast<std::streamoff>(header_bytes));
+			in.read(
+				reinterpret_cast<char*>(kernel.Kernel.data()),
+				static_cast<std::streamsize>(header.kernel_bytes()));
+			in.read(
+				reinterpret_cast<char*>(kernel.P_prev.data()),
+				static_cast<std::streamsize>(header.p_bytes()));
+			if (!in)
+				throw std::runtime_error("KernelCache::load() : the file cannot be read: " + path(key));
+
+			kernel.restore_advanced(static_cast<size_t>(header.lags));
+			return true;
+		}
+
+	private:
+		struct Header
+		{
+			char magic[8];
+			std::uint64_t key;
+			std::uint64_t rows;
+			std::uint64_t cols;
+			// nmbr of time frames advanced
+			std::uint64_t lags;
+			std::uint64_t width;
+			// KernelScalarTag of the stored Kernel
+			std::uint64_t scalar_tag;
+			std::uint64_t scalar_bytes;
+
+			Header() = default;
+
+			Header(
+				const KernelCacheKey& cacheKey,
+				std::uint64_t rows, std::uint64_t cols,
+				std::uint64_t lags, std::uint64_t width,
+				std::uint64_t scalar_tag,
+				std::uint64_t scalar_bytes) noexcept :
+				magic{ 'C', 'O', 'N', 'V', 'K', 'R', 'N', '2' },
+				key{ cacheKey.value() },
+				rows{ rows }, cols{ cols },
+				lags{ lags }, width{ width },
+				scalar_tag{ scalar_tag },
+				scalar_bytes{ scalar_bytes }
+			{}
+
+			size_t kernel_bytes() const noexcept
+			{
+				return static_cast<size_t>(rows * cols * scalar_bytes);
+			}
+
+			size_t p_bytes() const noexcept
+			{
+				return static_cast<size_t>(rows * width * sizeof(double));
+			}
+
+			template<typename Kernel_t>
+			bool fits(
+				const KernelCacheKey& cacheKey,
+				const Kernel_t& kernel,
+				std::uint64_t scalar_type,
+				size_t scalar_size) const noexcept
+			{
+				return std::memcmp(magic, "CONVKRN2", 8) == 0 &&
+					key == cacheKey.value() &&
+					rows == static_cast<std::uint64_t>(kernel.Kernel.rows()) &&
+					cols == static_cast<std::uint64_t>(kernel.stored_cols()) &&
+					width == static_cast<std::uint64_t>(kernel.block_width()) &&
+					scalar_tag == scalar_type &&
+					scalar_bytes == scalar_size &&
+					lags * width <= cols;
+			}
+		};
+		static_assert(sizeof(Header) <= header_bytes, "KernelCache: the header must fit a page.");
+
+		std::string its_directory;
+
+		static std::string random_suffix()
+		{
+			std::random_device device;
+			return std::to_string(device()) + std::to_string(device()) + ".tmp";
+		}
+	};
+} // Convolution
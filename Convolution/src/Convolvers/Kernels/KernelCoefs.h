@@ -0,0 +1,59 @@
+/*****************************************************************//**
+ * \file   KernelCoefs.h
+ * \brief  The file contains the policies of the staging
+ * coefficients of a kernel: which of P_prev, P_cur and F
+ * are stored, see BaseKernel.
+ *
+ * A new lag block is F*(P_cur - P_prev) for a well
+ * in the Poisson regime, while F == 1 for the reflections,
+ * and a fracture kernel multiplies by R instead of F.
+ * A coefficient which is not needed is not stored,
+ * and it is not multiplied by advance().
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#include <Eigen/Core>
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * @brief A coefficient which is not stored.
+	 * It holds no values, and any arithmetic with it
+	 * is a compile error.
+	 */
+	struct ElidedCoefs
+	{};
+
+	/**
+	 * @brief P_prev, P_cur and F are stored,
+	 * the new lag block is F*(P_cur - P_prev).
+	 * It is the default policy of BaseKernel.
+	 */
+	struct KernelCoefsFull
+	{
+		static constexpr bool has_F{ true };
+		using F_type = ArrayXXd;
+	};
+
+	/**
+	 * @brief F == 1 is not stored, e.g., the reflections
+	 * in a well, the new lag block is P_cur - P_prev
+	 */
+	struct KernelCoefsUnitF
+	{
+		static constexpr bool has_F{ false };
+		using F_type = ElidedCoefs;
+	};
+
+	/**
+	 * @brief The coefficients of BasicFracKernel:
+	 * the terms R*(U - U) are summed up by push_coef(),
+	 * so F is not stored, as in KernelCoefsUnitF
+	 */
+	using KernelCoefsFrac = KernelCoefsUnitF;
+} // Convolution
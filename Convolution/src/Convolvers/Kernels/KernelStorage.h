@@ -0,0 +1,357 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <Eigen/Core>
+
+#include "../Platform/MappedFile.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace Convolution
+{
+	using namespace Eigen;
+
+	/**
+	 * @brief The Kernel matrix is kept in RAM.
+	 * It is the default storage of BaseKernel.
+	 *
+	 * @tparam Scalar_t Type of the stored coefficients:
+	 * double, float, Eigen::bfloat16 or Eigen::half.
+	 * The coefficients are computed in double and rounded
+	 * once they are stored, the convolution is accumulated
+	 * in double, see KernelProduct.
+	 */
+	template<typename Scalar_t>
+	struct KernelStorageRAM_t
+	{
+		using Scalar = Scalar_t;
+		using matrix_type = Matrix<Scalar, Dynamic, Dynamic>;
+		// the lag blocks follow one another
+		static constexpr bool contiguous_lags{ true };
+
+		matrix_type create(Index rows, Index cols) const
+		{
+			return matrix_type(rows, cols);
+		}
+
+		/**
+		 * \brief The col of the matrix where
+		 * the col of the kernel is stored
+		 */
+		static constexpr Index lag_col(Index col, Index /*width*/) noexcept
+		{
+			return col;
+		}
+
+		/**
+		 * \brief The cols [col_begin; col_begin + col_count)
+		 * are going to be convolved
+		 */
+		static void advise_read(
+			const matrix_type&, Index /*col_begin*/, Index /*col_count*/) noexcept
+		{}
+
+		/**
+		 * \brief Only the first cols are kept, the rest are released
+		 */
+		static void shrink(matrix_type& kernel, Index cols)
+		{
+			kernel.conservativeResize(NoChange, cols);
+		}
+
+		/**
+		 * \brief Nmbr of the cols which are kept, see shrink()
+		 */
+		static Index stored_cols(const matrix_type& kernel) noexcept
+		{
+			return kernel.cols();
+		}
+	};
+
+	using KernelStorageRAM = KernelStorageRAM_t<double>;
+	// halves the memory traffic of the convolution
+	using KernelStorageFloat = KernelStorageRAM_t<float>;
+	// quarters it, 8 bits of mantissa
+	using KernelStorageBFloat16 = KernelStorageRAM_t<Eigen::bfloat16>;
+	// quarters it, 11 bits of mantissa, |value| < 65504
+	using KernelStorageHalf = KernelStorageRAM_t<Eigen::half>;
+
+	/**
+	 * @brief The Kernel is stored in a matrix
+	 * shared by several kernels lag by lag,
+	 * see PackedFracKernelContainer: the lag block l
+	 * of the kernel starts at the col l * lag_stride
+	 * of the Kernel matrix, and the cols between the lag blocks
+	 * belong to the other kernels.
+	 * So, the window of the kernel is not a block of the Kernel.
+	 * The memory is owned by the shared matrix.
+	 */
+	struct KernelStoragePacked
+	{
+		using Scalar = double;
+		using matrix_type = Map<MatrixXd>;
+		static constexpr bool contiguous_lags{ false };
+
+		// the first coefficient of the kernel
+		// within the shared matrix
+		double* place{ nullptr };
+		// nmbr of cols of a lag of all the kernels
+		Index lag_stride{ 0 };
+		// nmbr of cols of a lag block of the kernel
+		Index width{ 0 };
+
+		/**
+		 * \brief The Kernel spans the shared cols
+		 * from its first lag block to its last one
+		 *
+		 * \param cols Nmbr of cols of all the lag blocks
+		 */
+		matrix_type create(Index rows, Index cols) const
+		{
+			if (place == nullptr || width <= 0 || lag_stride < width)
+				throw std::runtime_error("KernelStoragePacked::create() : the shared matrix is not set.");
+			const Index lags = cols / width;
+			return matrix_type{ place, rows,
+				lags > 0 ? (lags - 1) * lag_stride + width : 0 };
+		}
+
+		Index lag_col(Index col, Index block_width) const noexcept
+		{
+			return col / block_width * lag_stride + col % block_width;
+		}
+
+		static void advise_read(
+			const matrix_type&, Index /*col_begin*/, Index /*col_count*/) noexcept
+		{}
+
+		/**
+		 * \brief The cols stay in the shared matrix,
+		 * the ones beyond the window are multiplied by zero flux
+		 */
+		static void shrink(matrix_type&, Index /*cols*/) noexcept
+		{}
+
+		static Index stored_cols(const matrix_type& kernel) noexcept
+		{
+			return kernel.cols();
+		}
+	};
+
+	/**
+	 * @brief Accuracy cost of a kernel stored
+	 * in a lower precision: the stored coefficients
+	 * are compared with the double ones they are rounded from.
+	 *
+	 * Since the convolution is accumulated in double,
+	 * its relative error is bounded by max_rel_error()
+	 * for a flux of the same sign.
+	 */
+	struct KernelPrecisionReport
+	{
+		// nmbr of compared coefficients
+		size_t values{ 0ull };
+		double max_abs_error{ 0.0 };
+		double max_abs_value{ 0.0 };
+		double sum_sq_error{ 0.0 };
+		double sum_sq_value{ 0.0 };
+
+		/**
+		 * \brief Max error relative to the max coefficient
+		 */
+		double max_rel_error() const noexcept
+		{
+			return max_abs_value > 0.0 ? max_abs_error / max_abs_value : 0.0;
+		}
+
+		/**
+		 * \brief Norm of the error relative to the norm of the kernel
+		 */
+		double rms_rel_error() const noexcept
+		{
+			return sum_sq_value > 0.0 ? std::sqrt(sum_sq_error / sum_sq_value) : 0.0;
+		}
+
+		template<typename Exact, typename Stored>
+		void add(const Exact& exact, const Stored& stored)
+		{
+			if (exact.size() == 0)
+				return;
+			const auto error = (stored.template cast<double>() - exact).array().abs();
+			values += static_cast<size_t>(exact.size());
+			max_abs_error = (std::max)(max_abs_error, error.maxCoeff());
+			max_abs_value = (std::max)(max_abs_value, exact.array().abs().maxCoeff());
+			sum_sq_error += error.square().sum();
+			sum_sq_value += exact.squaredNorm();
+		}
+	};
+
+	/**
+	 * @brief A ColMajor matrix mapped to a scratch file,
+	 * see MappedFile. It is used as a MatrixXd:
+	 * the blocks of it are Eigen expressions over the mapped pages.
+	 * The Map keeps all the cols it is created with,
+	 * once the pages of the last cols are released by shrink(),
+	 * only stored_cols() of them are accessed.
+	 */
+	class MappedMatrix :
+		private MappedFile,
+		public Map<MatrixXd>
+	{
+	public:
+		MappedMatrix(Index rows, Index cols, const std::string& path) :
+			MappedFile{
+				static_cast<size_t>(rows * cols) * sizeof(double),
+				path },
+			Map<MatrixXd>{
+				static_cast<double*>(MappedFile::data()), rows, cols },
+			its_stored_cols{ cols }
+		{
+			// the window is read from the first col to the last
+			MappedFile::advise_sequential();
+		}
+
+		MappedMatrix(MappedMatrix&& other) noexcept :
+			MappedFile{ std::move(static_cast<MappedFile&>(other)) },
+			// the pages stay at the same address
+			Map<MatrixXd>{ static_cast<Map<MatrixXd>&>(other) },
+			its_stored_cols{ other.its_stored_cols }
+		{}
+
+		using Map<MatrixXd>::operator=;
+		using Map<MatrixXd>::data;
+		using Map<MatrixXd>::size;
+
+		/**
+		 * \brief Only the first cols are kept,
+		 * the pages of the rest are released
+		 */
+		void shrink(Index cols)
+		{
+			if (cols >= its_stored_cols)
+				return;
+			MappedFile::shrink(static_cast<size_t>(rows() * cols) * sizeof(double));
+			its_stored_cols = cols;
+		}
+
+		Index stored_cols() const noexcept
+		{
+			return its_stored_cols;
+		}
+
+		/**
+		 * \brief The cols are read ahead from the file
+		 */
+		void advise_read(Index col_begin, Index col_count) const noexcept
+		{
+			const size_t col_bytes = static_cast<size_t>(rows()) * sizeof(double);
+			MappedFile::advise_will_need(
+				static_cast<size_t>(col_begin) * col_bytes,
+				static_cast<size_t>(col_count) * col_bytes);
+		}
+
+	private:
+		Index its_stored_cols;
+	};
+
+	/**
+	 * @brief The Kernel matrix is mapped to a scratch file
+	 * in directory(), so the kernels may exceed the RAM.
+	 *
+	 * The directory is taken from the CONVOLUTION_KERNEL_DIR
+	 * environment variable, or it is the temporary directory
+	 * of the system, or it is set with set_directory().
+	 * A kernel is not created without a directory,
+	 * since anonymous memory would not leave the RAM.
+	 */
+	struct KernelStorageFile
+	{
+		using Scalar = double;
+		using matrix_type = MappedMatrix;
+		static constexpr bool contiguous_lags{ true };
+
+		explicit KernelStorageFile(std::string kernelName = "Kernel") :
+			kernel_name{ std::move(kernelName) }
+		{}
+
+		static void set_directory(const std::string& dir)
+		{
+			directory_ref() = dir;
+		}
+
+		static const std::string& directory()
+		{
+			return directory_ref();
+		}
+
+		/**
+		 * \brief The file name is unique per kernel,
+		 * since many kernels share the same name
+		 */
+		matrix_type create(Index rows, Index cols) const
+		{
+			if (directory().empty())
+				throw std::runtime_error(
+					"KernelStorageFile: the directory of the kernel files is not set.");
+
+			static std::atomic<size_t> kernel_counter{ 0ull };
+			return matrix_type{ rows, cols,
+				directory() + "/" + kernel_name +
+				"_" + std::to_string(process_id()) +
+				"_" + std::to_string(kernel_counter++) + ".kernel" };
+		}
+
+		static constexpr Index lag_col(Index col, Index /*width*/) noexcept
+		{
+			return col;
+		}
+
+		static void advise_read(
+			const matrix_type& kernel, Index col_begin, Index col_count) noexcept
+		{
+			kernel.advise_read(col_begin, col_count);
+		}
+
+		static void shrink(matrix_type& kernel, Index cols)
+		{
+			kernel.shrink(cols);
+		}
+
+		static Index stored_cols(const matrix_type& kernel) noexcept
+		{
+			return kernel.stored_cols();
+		}
+
+	private:
+		std::string kernel_name;
+
+		static std::string& directory_ref()
+		{
+			static std::string dir = []()
+			{
+				const char* env = std::getenv("CONVOLUTION_KERNEL_DIR");
+				if (env)
+					return std::string{ env };
+				std::error_code error;
+				const auto temp = std::filesystem::temp_directory_path(error);
+				return error ? std::string{} : temp.string();
+			}();
+			return dir;
+		}
+
+		static unsigned long process_id()
+		{
+#ifdef _WIN32
+			return static_cast<unsigned long>(GetCurrentProcessId());
+#else
+			return static_cast<unsigned long>(getpid());
+#endif
+		}
+	};
+} // Convolution
@@ -9,16 +9,19 @@ namespace Convolution
 	 * 
 	 * @tparam Allocator_t Type of the class that manages access 
 	 * to the coefs container on push and on extract
+	 * @tparam Storage_t Policy which allocates the Kernel matrix,
+	 * the RAM by default, see WellKernelFile
 	 */
-	template<typename Allocator_t>
+	template<typename Allocator_t, typename Storage_t = KernelStorageRAM>
 	class AdvancedWellKernel :
-		public BaseKernelFile<Allocator_t>
+		public BaseKernel<Allocator_t, Storage_t>
 	{
 	public:
 		AdvancedWellKernel(
 			size_t nodesCount,
-			const typename KernelTypedefs<Allocator_t>::Allocator& convDesc) :
-			BaseKernelFile{ nodesCount, convDesc, "WellKernelAdvanced" }
+			const typename KernelTypedefs<Allocator_t>::Allocator& convDesc,
+			const Storage_t& storage = Storage_t{}) :
+			BaseKernel<Allocator_t, Storage_t>{ nodesCount, convDesc, storage }
 		{}
 
 		/**
@@ -160,5 +163,24 @@ namespace Convolution
 	public:
 		using AdvancedWellKernel::AdvancedWellKernel;
 	};
+
+	/**
+	 * @brief WellKernel whose Kernel matrix is mapped
+	 * to a scratch file, see KernelStorageFile,
+	 * so the kernels may exceed the RAM.
+	 * The ctor throws if there is no directory for the file.
+	 */
+	template<typename Allocator_t>
+	class WellKernelFile :
+		public AdvancedWellKernel<Allocator_t, KernelStorageFile>
+	{
+	public:
+		WellKernelFile(
+			size_t nodesCount,
+			const typename KernelTypedefs<Allocator_t>::Allocator& convDesc) :
+			AdvancedWellKernel<Allocator_t, KernelStorageFile>{
+				nodesCount, convDesc, KernelStorageFile{ "WellKernelAdvanced" } }
+		{}
+	};
 } // Convolution
 
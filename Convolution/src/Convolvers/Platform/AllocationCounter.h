@@ -0,0 +1,109 @@
+/*****************************************************************//**
+ * \file   AllocationCounter.h
+ * \brief  The file contains a counter of the heap allocations
+ * made by Eigen, to verify that the time stepping
+ * does not allocate once it is warmed up.
+ *
+ * Eigen checks every allocation with
+ * check_that_malloc_is_allowed() if EIGEN_RUNTIME_NO_MALLOC
+ * is defined, and the check is an eigen_assert.
+ * The header defines both, so the check increments the counter
+ * instead, and the other asserts are left as they are.
+ *
+ * The header must be included before any Eigen header,
+ * in every translation unit of the program, e.g.,
+ * it is a forced include of the Tests project.
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#ifdef EIGEN_CORE_H
+#error "AllocationCounter.h must be included before the Eigen headers."
+#endif
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+namespace Convolution
+{
+	/**
+	 * @brief Counts the heap allocations of Eigen
+	 * in all the threads.
+	 * An object counts the allocations made since its construction.
+	 */
+	class AllocationCounter
+	{
+	public:
+		AllocationCounter() noexcept :
+			start{ count() }
+		{}
+
+		/**
+		 * \brief Nmbr of allocations since the construction
+		 */
+		size_t allocations() const noexcept
+		{
+			return count() - start;
+		}
+
+		/**
+		 * \brief Nmbr of allocations since the program start
+		 */
+		static size_t count() noexcept
+		{
+			return counter().load(std::memory_order_relaxed);
+		}
+
+		static void on_malloc() noexcept
+		{
+			counter().fetch_add(1ull, std::memory_order_relaxed);
+		}
+
+		/**
+		 * \brief Whether an eigen_assert is the check of an allocation,
+		 * the message of the check is looked for in the asserted expression
+		 */
+		static constexpr bool is_malloc_check(const char* expression) noexcept
+		{
+			constexpr char message[] = "heap allocation is forbidden";
+			for (const char* begin = expression; *begin != '\0'; ++begin)
+			{
+				size_t idx = 0;
+				while (message[idx] != '\0' && begin[idx] == message[idx])
+					++idx;
+				if (message[idx] == '\0')
+					return true;
+			}
+			return false;
+		}
+
+	private:
+		size_t start;
+
+		static std::atomic<size_t>& counter() noexcept
+		{
+			static std::atomic<size_t> allocations{ 0ull };
+			return allocations;
+		}
+	};
+} // Convolution
+
+#ifndef EIGEN_RUNTIME_NO_MALLOC
+#define EIGEN_RUNTIME_NO_MALLOC
+#endif
+
+#ifndef eigen_assert
+// the allocations are counted whether they are allowed or not,
+// the other asserts are disabled by NDEBUG as usual
+// the asserted expression is matched at compile time,
+// so an assert costs no more than without the counter
+#define eigen_assert(x) \
+	(std::integral_constant<bool, \
+		::Convolution::AllocationCounter::is_malloc_check(#x)>::value ? \
+		::Convolution::AllocationCounter::on_malloc() : \
+		assert(x))
+#endif
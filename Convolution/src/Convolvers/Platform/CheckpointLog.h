@@ -0,0 +1,407 @@
+/*****************************************************************//**
+ * \file   CheckpointLog.h
+ * \brief  The file contains an append-only log
+ * of checkpoints of the convolution state,
+ * to restart a simulation without replaying it.
+ *
+ * An object takes part in a checkpoint by its method
+ *		template<typename Visitor_t>
+ *		void checkpoint(Visitor_t& visitor);
+ * which passes its state to the visitor as memory regions
+ * (visitor.pod(), visitor.array(), visitor.region())
+ * and its members with the state (visitor.object()),
+ * always in the same order. A trivially copyable object,
+ * e.g., an allocator descriptor or a time policy, is a region itself.
+ * A regime passes only its time policy, its kernels and fluxes
+ * are passed by themselves. The values derived from the state,
+ * e.g., the results of the convolutions, are not passed,
+ * they are recomputed at the next time step.
+ *
+ * A region is split into chunks of chunk_bytes, and only the chunks
+ * that changed since the previous checkpoint are appended.
+ * The kernels pass only their filled columns, so in ConstStep
+ * a checkpoint writes the kernel columns and the flux frames
+ * added since the previous one, and the descriptors.
+ *
+ * A checkpoint ends with a commit record, a torn checkpoint
+ * at the end of the log is ignored and overwritten.
+ * The restore maps the log and copies the chunks back
+ * in the order they were written.
+ *
+ * The checkpoints are taken between the time steps,
+ * i.e., after advance() of the kernels.
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "MappedFile.h"
+
+namespace Convolution
+{
+	template<typename T, typename Visitor_t, typename = void>
+	struct has_checkpoint : std::false_type
+	{};
+
+	template<typename T, typename Visitor_t>
+	struct has_checkpoint<T, Visitor_t, std::void_t<decltype(
+		std::declval<T&>().checkpoint(std::declval<Visitor_t&>()))>> :
+		std::true_type
+	{};
+
+	/**
+	 * @brief Common part of the visitors,
+	 * they differ in region() only
+	 */
+	template<typename Derived>
+	struct CheckpointVisitor
+	{
+		/**
+		 * \brief A trivially copyable object is stored byte-wise,
+		 * e.g., an allocator descriptor
+		 */
+		template<typename T>
+		void pod(T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value,
+				"CheckpointVisitor::pod() : the object must be trivially copyable, or provide checkpoint().");
+			derived().region(&value, sizeof(T));
+		}
+
+		/**
+		 * \brief An Eigen array or matrix whose size
+		 * is fixed at construction
+		 */
+		template<typename Dense>
+		void array(Dense& value)
+		{
+			derived().region(
+				value.data(),
+				static_cast<size_t>(value.size()) * sizeof(typename Dense::Scalar));
+		}
+
+		template<typename T>
+		void object(T& value)
+		{
+			if constexpr (has_checkpoint<T, Derived>::value)
+				value.checkpoint(derived());
+			else
+				pod(value);
+		}
+
+	private:
+		Derived& derived() noexcept
+		{
+			return static_cast<Derived&>(*this);
+		}
+	};
+
+	class CheckpointLog
+	{
+	public:
+		static constexpr size_t chunk_bytes{ 64 * 1024 };
+
+		/**
+		 * \brief The log is created if it does not exist.
+		 * If it exists, the new checkpoints are appended to it
+		 * after the last complete one.
+		 */
+		explicit CheckpointLog(std::string path) :
+			its_path{ std::move(path) },
+			its_checkpoint_count{ 0ull }
+		{
+			std::error_code error;
+			const auto size = std::filesystem::file_size(its_path, error);
+			size_t committed = 0;
+			if (!error && size > 0)
+			{
+				MappedFile file = MappedFile::copy_on_write(its_path);
+				committed = scan(file, nullptr);
+				if (committed == 0)
+					throw std::runtime_error("CheckpointLog: the file is not a checkpoint log: " + its_path);
+			}
+			if (committed == 0)
+			{
+				std::ofstream create{ its_path, std::ios::binary | std::ios::trunc };
+				create.write(magic, sizeof(magic));
+				committed = sizeof(magic);
+			}
+			else if (committed != static_cast<size_t>(size))
+				// a torn checkpoint is dropped
+				std::filesystem::resize_file(its_path, committed);
+
+			out.open(its_path, std::ios::binary | std::ios::app);
+			if (!out)
+				throw std::runtime_error("CheckpointLog: the log cannot be opened: " + its_path);
+		}
+
+		const std::string& path() const noexcept
+		{
+			return its_path;
+		}
+
+		/**
+		 * \brief Nmbr of complete checkpoints in the log
+		 */
+		size_t checkpoint_count() const noexcept
+		{
+			return its_checkpoint_count;
+		}
+
+		/**
+		 * \brief Appends a checkpoint of the objects,
+		 * only the chunks changed since the previous
+		 * write() or restore() are written
+		 */
+		template<typename... Objects>
+		void write(Objects&... objects)
+		{
+			Writer writer{ *this };
+			(writer.object(objects), ...);
+			append(Record{ Record::commit, its_checkpoint_count + 1, writer.region_count, 0ull }, nullptr);
+			out.flush();
+			if (!out)
+				throw std::runtime_error("CheckpointLog::write() : the log cannot be written: " + its_path);
+			++its_checkpoint_count;
+		}
+
+		/**
+		 * \brief Restores the objects to the last
+		 * complete checkpoint. The objects must be constructed
+		 * as the ones the log was written for.
+		 *
+		 * \return false if there is no checkpoint
+		 */
+		template<typename... Objects>
+		bool restore(Objects&... objects)
+		{
+			if (its_checkpoint_count == 0)
+				return false;
+
+			MappedFile file = MappedFile::copy_on_write(its_path);
+			Reader reader{ *this, file };
+			scan(file, &reader.index);
+			(reader.object(objects), ...);
+			if (reader.region_count != reader.index.sizes.size())
+				throw std::runtime_error("CheckpointLog::restore() : the objects do not match the log.");
+			return true;
+		}
+
+	private:
+		struct Record
+		{
+			enum : std::uint64_t { chunk = 1, size = 2, commit = 3 };
+
+			std::uint64_t kind;
+			// region id, or checkpoint nmbr for commit
+			std::uint64_t region;
+			// byte offset within the region,
+			// or region size, or region count for commit
+			std::uint64_t offset;
+			// payload bytes
+			std::uint64_t bytes;
+		};
+
+		// positions of the records of the last checkpoints
+		struct Index
+		{
+			// per region, in the order of the log
+			std::vector<std::vector<size_t>> chunks;
+			// per region, of the last checkpoint
+			std::vector<size_t> sizes;
+		};
+
+		static constexpr char magic[8]{ 'C', 'O', 'N', 'V', 'C', 'K', 'P', '1' };
+
+		std::string its_path;
+		std::ofstream out;
+		size_t its_checkpoint_count;
+		// per region, hashes of the chunks of the last checkpoint
+		std::vector<std::vector<std::uint64_t>> hashes;
+
+		static size_t padded(size_t bytes) noexcept
+		{
+			return (bytes + 7) / 8 * 8;
+		}
+
+		static std::uint64_t hash(const char* data, size_t bytes) noexcept
+		{
+			std::uint64_t h = 14695981039346656037ull ^ bytes;
+			size_t i = 0;
+			for (; i + 8 <= bytes; i += 8)
+			{
+				std::uint64_t word;
+				std::memcpy(&word, data + i, 8);
+				h = (h ^ word) * 1099511628211ull;
+				h ^= h >> 29;
+			}
+			for (; i < bytes; ++i)
+				h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+			return h;
+		}
+
+		void append(const Record& record, const char* payload)
+		{
+			static const char zeros[8]{};
+			out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			if (record.bytes > 0)
+			{
+				out.write(payload, static_cast<std::streamsize>(record.bytes));
+				out.write(zeros, static_cast<std::streamsize>(
+					padded(record.bytes) - record.bytes));
+			}
+		}
+
+		/**
+		 * \brief Reads the records up to the last commit
+		 *
+		 * \return The end of the last complete checkpoint,
+		 * 0 if the file is not a log
+		 */
+		size_t scan(const MappedFile& file, Index* index)
+		{
+			const char* begin = static_cast<const char*>(file.data());
+			const size_t size = file.size();
+			if (size < sizeof(magic) || std::memcmp(begin, magic, sizeof(magic)) != 0)
+				return 0ull;
+
+			its_checkpoint_count = 0;
+			size_t committed = sizeof(magic);
+			size_t committed_chunks = 0;
+			Index scanned;
+			std::vector<std::pair<size_t, size_t>> chunks;
+			std::vector<size_t> sizes;
+			size_t position = sizeof(magic);
+			while (position + sizeof(Record) <= size)
+			{
+				Record record;
+				std::memcpy(&record, begin + position, sizeof(record));
+				const size_t next = position + sizeof(Record) + padded(record.bytes);
+				if (next > size || record.kind < Record::chunk || record.kind > Record::commit)
+					break;
+				if (record.kind == Record::chunk)
+					chunks.emplace_back(static_cast<size_t>(record.region), position);
+				else if (record.kind == Record::size)
+				{
+					if (sizes.size() <= record.region)
+						sizes.resize(static_cast<size_t>(record.region) + 1);
+					sizes[record.region] = static_cast<size_t>(record.offset);
+				}
+				else
+				{
+					its_checkpoint_count = static_cast<size_t>(record.region);
+					committed = next;
+					committed_chunks = chunks.size();
+					scanned.sizes.assign(sizes.begin(),
+						sizes.begin() + static_cast<std::ptrdiff_t>(record.offset));
+				}
+				position = next;
+			}
+
+			if (index)
+			{
+				index->sizes = std::move(scanned.sizes);
+				index->chunks.assign(index->sizes.size(), {});
+				for (size_t id = 0; id < committed_chunks; ++id)
+					if (chunks[id].first < index->chunks.size())
+						index->chunks[chunks[id].first].push_back(chunks[id].second);
+			}
+			return committed;
+		}
+
+		struct Writer : public CheckpointVisitor<Writer>
+		{
+			CheckpointLog& log;
+			size_t region_count{ 0ull };
+
+			explicit Writer(CheckpointLog& log) :
+				log{ log }
+			{}
+
+			void region(void* data, size_t bytes)
+			{
+				const size_t id = region_count++;
+				if (log.hashes.size() <= id)
+					log.hashes.resize(id + 1);
+				std::vector<std::uint64_t>& region_hashes = log.hashes[id];
+				const size_t known = region_hashes.size();
+				const size_t chunk_count = (bytes + chunk_bytes - 1) / chunk_bytes;
+				region_hashes.resize(chunk_count);
+
+				const char* begin = static_cast<const char*>(data);
+				for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+				{
+					const size_t offset = chunk * chunk_bytes;
+					const size_t count = (std::min)(chunk_bytes, bytes - offset);
+					const std::uint64_t h = hash(begin + offset, count);
+					if (chunk < known && region_hashes[chunk] == h)
+						continue;
+					region_hashes[chunk] = h;
+					log.append(Record{ Record::chunk, id, offset, count }, begin + offset);
+				}
+				log.append(Record{ Record::size, id, bytes, 0ull }, nullptr);
+			}
+		};
+
+		struct Reader : public CheckpointVisitor<Reader>
+		{
+			CheckpointLog& log;
+			const MappedFile& file;
+			Index index;
+			size_t region_count{ 0ull };
+
+			Reader(CheckpointLog& log, const MappedFile& file) :
+				log{ log },
+				file{ file }
+			{}
+
+			void region(void* data, size_t bytes)
+			{
+				const size_t id = region_count++;
+				if (id >= index.sizes.size() || index.sizes[id] != bytes)
+					throw std::runtime_error("CheckpointLog::restore() : the objects do not match the log.");
+
+				char* target = static_cast<char*>(data);
+				const char* begin = static_cast<const char*>(file.data());
+				for (size_t position : index.chunks[id])
+				{
+					Record record;
+					std::memcpy(&record, begin + position, sizeof(record));
+					// the part beyond the live range of the last checkpoint
+					// is out of date
+					if (record.offset >= bytes)
+						continue;
+					std::memcpy(
+						target + record.offset,
+						begin + position + sizeof(Record),
+						(std::min)(static_cast<size_t>(record.bytes),
+							bytes - static_cast<size_t>(record.offset)));
+				}
+
+				// the next checkpoint is incremental to this one
+				if (log.hashes.size() <= id)
+					log.hashes.resize(id + 1);
+				std::vector<std::uint64_t>& region_hashes = log.hashes[id];
+				region_hashes.resize((bytes + chunk_bytes - 1) / chunk_bytes);
+				for (size_t chunk = 0; chunk < region_hashes.size(); ++chunk)
+				{
+					const size_t offset = chunk * chunk_bytes;
+					region_hashes[chunk] = hash(
+						target + offset, (std::min)(chunk_bytes, bytes - offset));
+				}
+			}
+		};
+	};
+} // Convolution
@@ -0,0 +1,327 @@
+/*****************************************************************//**
+ * \file   MappedFile.h
+ * \brief  The file contains a memory region mapped
+ * to a scratch file, so the data may exceed the RAM
+ * and the operating system pages it in and out.
+ *
+ * The file is created zero-filled and it is removed
+ * once the region is unmapped (it is unlinked right away
+ * on Linux, and it is opened with FILE_FLAG_DELETE_ON_CLOSE
+ * on Windows). If no path is given, the region is anonymous.
+ *
+ * An existing file can be mapped copy-on-write, see copy_on_write():
+ * the pages are read from the file on demand,
+ * and the changes stay in the memory of the process.
+ *
+ * Access hints (sequential read, read-ahead of a range)
+ * are passed to madvise on Linux, and ignored on Windows.
+ *********************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Convolution
+{
+	class MappedFile
+	{
+	public:
+		MappedFile() noexcept :
+			its_data{ nullptr },
+			its_size{ 0ull }
+		{}
+
+		/**
+		 * \param bytes Size of the region
+		 * \param path Scratch file, if it is empty
+		 * the region is anonymous
+		 */
+		MappedFile(size_t bytes, const std::string& path) :
+			MappedFile{}
+		{
+			if (bytes == 0)
+				return;
+			its_data = path.empty() ?
+				map_anonymous(bytes) :
+				map_file(bytes, path);
+			its_size = bytes;
+		}
+
+		/**
+		 * \brief The whole existing file is mapped copy-on-write,
+		 * the file itself is never changed
+		 */
+		static MappedFile copy_on_write(const std::string& path)
+		{
+			MappedFile file;
+			file.its_data = map_existing(path, file.its_size);
+			return file;
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& other) noexcept :
+			its_data{ std::exchange(other.its_data, nullptr) },
+			its_size{ std::exchange(other.its_size, 0ull) }
+		{}
+
+		MappedFile& operator=(MappedFile&& other) noexcept
+		{
+			if (this != &other)
+			{
+				release();
+				its_data = std::exchange(other.its_data, nullptr);
+				its_size = std::exchange(other.its_size, 0ull);
+			}
+			return *this;
+		}
+
+		~MappedFile()
+		{
+			release();
+		}
+
+		void* data() const noexcept
+		{
+			return its_data;
+		}
+
+		size_t size() const noexcept
+		{
+			return its_size;
+		}
+
+		/**
+		 * \brief The pages beyond the first bytes are released.
+		 * On Windows the pages of a file view stay mapped,
+		 * the pages of an anonymous region are decommitted.
+		 */
+		void shrink(size_t bytes) noexcept
+		{
+			if (its_data == nullptr || bytes >= its_size)
+				return;
+#ifndef _WIN32
+			const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			const size_t keep = (std::max)((bytes + page - 1) / page * page, page);
+			if (keep >= its_size)
+				return;
+			munmap(static_cast<char*>(its_data) + keep, its_size - keep);
+			its_size = keep;
+#else
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			const size_t page = static_cast<size_t>(info.dwPageSize);
+			const size_t keep = (bytes + page - 1) / page * page;
+			MEMORY_BASIC_INFORMATION region;
+			if (keep < its_size &&
+				VirtualQuery(its_data, &region, sizeof(region)) &&
+				region.Type != MEM_MAPPED)
+				VirtualFree(static_cast<char*>(its_data) + keep, its_size - keep, MEM_DECOMMIT);
+#endif
+		}
+
+		/**
+		 * \brief The region is going to be read
+		 * from the lower to the higher addresses
+		 */
+		void advise_sequential() const noexcept
+		{
+#ifndef _WIN32
+			if (its_data)
+				madvise(its_data, its_size, MADV_SEQUENTIAL);
+#endif
+		}
+
+		/**
+		 * \brief The range [offset; offset + bytes)
+		 * is going to be read soon, so it is read ahead
+		 */
+		void advise_will_need(size_t offset, size_t bytes) const noexcept
+		{
+#ifndef _WIN32
+			if (!its_data || offset >= its_size)
+				return;
+			const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			const size_t begin = offset / page * page;
+			const size_t end = (std::min)(offset + bytes, its_size);
+			madvise(static_cast<char*>(its_data) + begin, end - begin, MADV_WILLNEED);
+#else
+			(void)offset;
+			(void)bytes;
+#endif
+		}
+
+	private:
+#ifdef _WIN32
+		static void* map_anonymous(size_t bytes)
+		{
+			void* place = VirtualAlloc(
+				nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			if (place == nullptr)
+				throw std::runtime_error("MappedFile: VirtualAlloc failed.");
+			return place;
+		}
+
+		static void* map_file(size_t bytes, const std::string& path)
+		{
+			HANDLE file = CreateFileA(
+				path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+				CREATE_ALWAYS,
+				FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+				nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("MappedFile: the file cannot be created: " + path);
+
+			const std::uint64_t size = static_cast<std::uint64_t>(bytes);
+			HANDLE mapping = CreateFileMappingA(
+				file, nullptr, PAGE_READWRITE,
+				static_cast<DWORD>(size >> 32),
+				static_cast<DWORD>(size & 0xFFFFFFFFull),
+				nullptr);
+			// the view keeps the mapping and the file alive
+			CloseHandle(file);
+			if (mapping == nullptr)
+				throw std::runtime_error("MappedFile: CreateFileMapping failed: " + path);
+
+			void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+			CloseHandle(mapping);
+			if (view == nullptr)
+				throw std::runtime_error("MappedFile: MapViewOfFile failed: " + path);
+			return view;
+		}
+
+		static void* map_existing(const std::string& path, size_t& bytes)
+		{
+			HANDLE file = CreateFileA(
+				path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("MappedFile: the file cannot be opened: " + path);
+
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+			{
+				CloseHandle(file);
+				throw std::runtime_error("MappedFile: the file is empty: " + path);
+			}
+			bytes = static_cast<size_t>(size.QuadPart);
+
+			HANDLE mapping = CreateFileMappingA(
+				file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			CloseHandle(file);
+			if (mapping == nullptr)
+				throw std::runtime_error("MappedFile: CreateFileMapping failed: " + path);
+
+			void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, bytes);
+			CloseHandle(mapping);
+			if (view == nullptr)
+				throw std::runtime_error("MappedFile: MapViewOfFile failed: " + path);
+			return view;
+		}
+
+		void release() noexcept
+		{
+			if (its_data == nullptr)
+				return;
+			// a view of a file and a VirtualAlloc region
+			// are told apart by the memory type
+			MEMORY_BASIC_INFORMATION info;
+			if (VirtualQuery(its_data, &info, sizeof(info)) &&
+				info.Type == MEM_MAPPED)
+				UnmapViewOfFile(its_data);
+			else
+				VirtualFree(its_data, 0, MEM_RELEASE);
+			its_data = nullptr;
+			its_size = 0ull;
+		}
+#else
+		static void* map_anonymous(size_t bytes)
+		{
+			void* place = mmap(
+				nullptr, bytes, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (place == MAP_FAILED)
+				throw std::runtime_error("MappedFile: anonymous mmap failed.");
+			return place;
+		}
+
+		static void* map_file(size_t bytes, const std::string& path)
+		{
+			int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+			if (fd < 0)
+				throw std::runtime_error("MappedFile: the file cannot be created: " + path);
+			// the mapping keeps the data,
+			// the name is not needed any more
+			unlink(path.c_str());
+			if (ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+			{
+				close(fd);
+				throw std::runtime_error("MappedFile: ftruncate failed: " + path);
+			}
+			void* place = mmap(
+				nullptr, bytes, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+			close(fd);
+			if (place == MAP_FAILED)
+				throw std::runtime_error("MappedFile: mmap failed: " + path);
+			return place;
+		}
+
+		static void* map_existing(const std::string& path, size_t& bytes)
+		{
+			int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				throw std::runtime_error("MappedFile: the file cannot be opened: " + path);
+			struct stat info;
+			if (fstat(fd, &info) != 0 || info.st_size == 0)
+			{
+				close(fd);
+				throw std::runtime_error("MappedFile: the file is empty: " + path);
+			}
+			bytes = static_cast<size_t>(info.st_size);
+			// the private mapping of a read-only file is writable,
+			// the changes are never written back
+			void* place = mmap(
+				nullptr, bytes, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (place == MAP_FAILED)
+				throw std::runtime_error("MappedFile: mmap failed: " + path);
+			return place;
+		}
+
+		void release() noexcept
+		{
+			if (its_data == nullptr)
+				return;
+			munmap(its_data, its_size);
+			its_data = nullptr;
+			its_size = 0ull;
+		}
+#endif
+
+	private:
+		void* its_data;
+		size_t its_size;
+	};
+} // Convolution
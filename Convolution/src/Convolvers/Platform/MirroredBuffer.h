@@ -0,0 +1,231 @@
+/*****************************************************************//**
+ * \file   MirroredBuffer.h
+ * \brief  The file contains a buffer of doubles whose
+ * physical pages are mapped twice, back to back,
+ * in the virtual address space.
+ *
+ * So, data[i] and data[i + capacity()] is the same memory,
+ * and any segment of length <= capacity() starting
+ * in [0; capacity()) is contiguous in memory,
+ * even if it wraps around the end of the buffer.
+ *
+ * It is implemented with memfd_create/mmap on Linux
+ * and with CreateFileMapping/MapViewOfFileEx on Windows.
+ *********************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Convolution
+{
+	class MirroredBuffer
+	{
+	public:
+		MirroredBuffer() noexcept :
+			its_data{ nullptr },
+			its_capacity{ 0ull }
+		{}
+
+		/**
+		 * \brief Maps the buffer twice.
+		 *
+		 * \param min_capacity Minimal nmbr of doubles to be stored.
+		 * It is rounded up to the mapping granularity.
+		 */
+		explicit MirroredBuffer(size_t min_capacity) :
+			MirroredBuffer{}
+		{
+			its_capacity = capacity_for(min_capacity);
+			its_data = static_cast<double*>(map(its_capacity * sizeof(double)));
+		}
+
+		MirroredBuffer(const MirroredBuffer&) = delete;
+		MirroredBuffer& operator=(const MirroredBuffer&) = delete;
+
+		MirroredBuffer(MirroredBuffer&& other) noexcept :
+			its_data{ std::exchange(other.its_data, nullptr) },
+			its_capacity{ std::exchange(other.its_capacity, 0ull) }
+		{}
+
+		MirroredBuffer& operator=(MirroredBuffer&& other) noexcept
+		{
+			if (this != &other)
+			{
+				release();
+				its_data = std::exchange(other.its_data, nullptr);
+				its_capacity = std::exchange(other.its_capacity, 0ull);
+			}
+			return *this;
+		}
+
+		~MirroredBuffer()
+		{
+			release();
+		}
+
+		/**
+		 * \brief Nmbr of doubles that can be stored,
+		 * the mapped region is twice larger
+		 */
+		size_t capacity() const noexcept
+		{
+			return its_capacity;
+		}
+
+		double* data() noexcept
+		{
+			return its_data;
+		}
+
+		const double* data() const noexcept
+		{
+			return its_data;
+		}
+
+		/**
+		 * \brief Nmbr of doubles that will be actually allocated
+		 * for a requested capacity
+		 */
+		static size_t capacity_for(size_t min_capacity)
+		{
+			const size_t page = granularity();
+			size_t bytes = (std::max)(min_capacity, size_t{ 1 }) * sizeof(double);
+			bytes = (bytes + page - 1) / page * page;
+			return bytes / sizeof(double);
+		}
+
+		/**
+		 * \brief Size (in bytes) of the mapped regions
+		 * must be a multiple of this value
+		 */
+		static size_t granularity()
+		{
+#ifdef _WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return static_cast<size_t>(info.dwAllocationGranularity);
+#else
+			return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+		}
+
+	private:
+#ifdef _WIN32
+		static void* map(size_t bytes)
+		{
+			const std::uint64_t size = static_cast<std::uint64_t>(bytes);
+			HANDLE mapping = CreateFileMappingW(
+				INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+				static_cast<DWORD>(size >> 32),
+				static_cast<DWORD>(size & 0xFFFFFFFFull),
+				nullptr);
+			if (mapping == nullptr)
+				throw std::runtime_error("MirroredBuffer: CreateFileMapping failed.");
+
+			// the address found for 2*bytes can be taken
+			// by another thread before both views are mapped,
+			// so the search is repeated
+			for (int attempt = 0; attempt < 16; ++attempt)
+			{
+				char* place = static_cast<char*>(
+					VirtualAlloc(nullptr, 2 * bytes, MEM_RESERVE, PAGE_NOACCESS));
+				if (place == nullptr)
+					break;
+				VirtualFree(place, 0, MEM_RELEASE);
+
+				void* first = MapViewOfFileEx(
+					mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes, place);
+				if (first == nullptr)
+					continue;
+				void* second = MapViewOfFileEx(
+					mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes, place + bytes);
+				if (second == nullptr)
+				{
+					UnmapViewOfFile(first);
+					continue;
+				}
+				// the views keep the mapping alive
+				CloseHandle(mapping);
+				return first;
+			}
+			CloseHandle(mapping);
+			throw std::runtime_error("MirroredBuffer: the views cannot be mapped back to back.");
+		}
+#else
+		static void* map(size_t bytes)
+		{
+			int fd = memfd_create("convolution_ring", MFD_CLOEXEC);
+			if (fd < 0)
+				throw std::runtime_error("MirroredBuffer: memfd_create failed.");
+			if (ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+			{
+				close(fd);
+				throw std::runtime_error("MirroredBuffer: ftruncate failed.");
+			}
+
+			// reserve 2*bytes of address space,
+			// then put the same pages in both halves
+			char* place = static_cast<char*>(mmap(
+				nullptr, 2 * bytes, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+			if (place == MAP_FAILED)
+			{
+				close(fd);
+				throw std::runtime_error("MirroredBuffer: address space cannot be reserved.");
+			}
+			for (size_t half = 0; half < 2; ++half)
+			{
+				void* view = mmap(
+					place + half * bytes, bytes,
+					PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_FIXED, fd, 0);
+				if (view == MAP_FAILED)
+				{
+					munmap(place, 2 * bytes);
+					close(fd);
+					throw std::runtime_error("MirroredBuffer: mmap failed.");
+				}
+			}
+			// the mappings keep the memory alive
+			close(fd);
+			return place;
+		}
+#endif
+
+		void release() noexcept
+		{
+			if (its_data == nullptr)
+				return;
+			const size_t bytes = its_capacity * sizeof(double);
+#ifdef _WIN32
+			UnmapViewOfFile(reinterpret_cast<char*>(its_data) + bytes);
+			UnmapViewOfFile(its_data);
+#else
+			munmap(its_data, 2 * bytes);
+#endif
+			its_data = nullptr;
+			its_capacity = 0ull;
+		}
+
+	private:
+		double* its_data;
+		size_t its_capacity;
+	};
+} // Convolution
@@ -16,7 +16,11 @@
 #include "../Fluxes/WellFlux.h"
 #include "../Fluxes/FracFlux.h"
 #include "../Fluxes/CommonFluxMulti.h"
+#include "../Fluxes/EnsembleFluxContainer.h"
 #include "../Allocators/AllocatorConstStep.h"
+#include "../Allocators/AllocatorRingStep.h"
+#include "../Engines/BlockFFTConvolver.h"
+#include "../Kernels/ExponentialKernel.h"
 
 namespace Convolution
 {
@@ -56,6 +60,24 @@ namespace Convolution
 				WellFluxCount
 			>;
 
+		// fluxes of several scenarios,
+		// convolved with the same kernels at once
+		using WellFluxEnsembleMulti =
+			CommonFluxMulti
+			<
+				typename Flux, EnsembleWellFlux,
+				WellFluxCount
+			>;
+
+		// the same fluxes stored in a ring
+		// bounded by frame_temporal_size
+		using WellFluxRingMulti =
+			CommonFluxMulti
+			<
+				FluxRingStep, BaseWellFlux,
+				WellFluxCount
+			>;
+
 		/**
 		 * @param spatial_size nmbr of segments 
 		 * within a well
@@ -76,6 +98,64 @@ namespace Convolution
 			frame_temporal_size
 		}
 		{}
+
+		/**
+		 * @brief Allocator for the well fluxes
+		 * stored in a ring, i.e., the memory is allocated
+		 * for frame_temporal_size time moments only
+		 */
+		FluxRingStep ring_flux() const
+		{
+			return FluxRingStep{
+				KernelConstStep::pusher.spatial_size(),
+				KernelConstStep::pusher.temporal_size() };
+		}
+
+		/**
+		 * @brief Frequency-domain engine for the well:
+		 * it replaces flux.extract().convolve(kernel)
+		 * with convolver.convolve(kernel, flux.extract())
+		 *
+		 * @param rows nmbr of mesh points
+		 * @param block_size nmbr of lags in a partition, a power of 2
+		 * @param tolerance if positive, the results are verified
+		 * against the direct product
+		 */
+		BlockFFTConvolver fft_convolver(
+			size_t rows,
+			size_t block_size = 64ull,
+			double tolerance = 0.0) const
+		{
+			return BlockFFTConvolver{
+				rows,
+				KernelConstStep::pusher.spatial_size(),
+				KernelConstStep::pusher.temporal_size(),
+				block_size,
+				tolerance };
+		}
+
+		/**
+		 * @brief Sum-of-exponentials representation
+		 * of the well kernel, updated recursively,
+		 * it is used as fft_convolver()
+		 *
+		 * @param rows nmbr of mesh points
+		 * @param tolerance max error of the fit
+		 * relative to the kernel values
+		 * @param exact_lags min nmbr of the recent lags kept exact
+		 */
+		ExponentialKernel exponential_kernel(
+			size_t rows,
+			double tolerance,
+			size_t exact_lags = 4ull) const
+		{
+			return ExponentialKernel{
+				rows,
+				KernelConstStep::pusher.spatial_size(),
+				KernelConstStep::pusher.temporal_size(),
+				tolerance,
+				exact_lags };
+		}
 	};
 
 	template<size_t WellFluxCount>
@@ -155,6 +235,12 @@ namespace Convolution
 			ConstStepFrac<WellFluxCount>{ constStep },
 			TimePolicyConstStep{ timePolicy }
 		{}
+
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			visitor.pod(static_cast<TimePolicyConstStep&>(*this));
+		}
 	};
 
 	template<size_t WellFluxCount>
@@ -14,6 +14,7 @@
 
 #pragma once
 #include "../Allocators/AllocatorMainStep.h"
+#include "../Fluxes/InterpolatedFluxMainStep.h"
 
 namespace Convolution
 {
@@ -32,6 +33,15 @@ namespace Convolution
 				Grids::AllNodeGroups::nodes_id::size
 			>;
 
+		// the flux history is stored once,
+		// the averaged fluxes are produced on extract
+		using WellFluxInterpolatedMulti =
+			CommonFluxMulti<
+				typename Flux, 
+				InterpolatedWellFluxMainStep,
+				Grids::AllNodeGroups::nodes_id::size
+			>;
+
 		MainStepWell(
 			size_t spatial_size,
 			size_t frame_temporal_size,
@@ -70,6 +80,16 @@ namespace Convolution
 			FracturesFluxContainer_t<
 			typename Flux, CommonFluxMulti_Alloc>;
 
+		template<typename Allocator_t>
+		using CommonFluxInterpolatedMulti_Alloc = 
+			CommonFluxMulti<Allocator_t,
+			InterpolatedFracFluxMainStep,
+			Grids::AllNodeGroups::nodes_id::size>;
+
+		using FracFluxInterpolatedMultiContainer = 
+			FracturesFluxContainer_t<
+			typename Flux, CommonFluxInterpolatedMulti_Alloc>;
+
 		std::vector<typename MainStepWell::Kernel> 
 			fracKernelRegime;
 		std::vector<typename MainStepWell::Flux> 
@@ -144,6 +164,12 @@ namespace Convolution
 			MainStepFrac{ mainStep },
 			TimePolicyMainStep{ timePolicy }
 		{}
+
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			visitor.pod(static_cast<TimePolicyMainStep&>(*this));
+		}
 	};
 
 	template<size_t WellFluxCount>
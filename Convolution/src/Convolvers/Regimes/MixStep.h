@@ -154,6 +154,12 @@ namespace Convolution
 			MixStepFrac{ mixStep },
 			TimePolicy{ timePolicy }
 		{}
+
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			visitor.pod(static_cast<TimePolicyMixStep&>(*this));
+		}
 	};
 
 	template<size_t WellFluxCount>
@@ -0,0 +1,179 @@
+/*****************************************************************//**
+ * \file   MultiLevel.h
+ * \brief  The file contains the MultiLevel regime.
+ *
+ * The time step is constant, the recent lags are convolved
+ * per time frame, and the older lags are convolved
+ * with the flux averaged over geometrically coarser bins,
+ * see AllocatorMultiLevel.h.
+ *
+ * The kernels are CumulativeKernel-s of the usual
+ * well and fracture kernels.
+ *
+ * \author artur.salamatin
+ * \date   June 2023
+ *********************************************************************/
+
+#pragma once
+#include "../Fluxes/CommonFluxMulti.h"
+#include "../Fluxes/MultiLevelFluxContainer.h"
+#include "../Kernels/WellKernel.h"
+#include "../Kernels/FracKernel.h"
+#include "../Kernels/CumulativeKernel.h"
+#include "../Allocators/AllocatorMultiLevel.h"
+#include "ConstStep.h"
+
+namespace Convolution
+{
+	/**
+	 * @brief Class controls time grid
+	 * for a MultiLevel regime.
+	 * The time step of the simulation is constant,
+	 * the bins of the level k average 2^k time steps.
+	 */
+	struct TimePolicyMultiLevel :
+		public TimePolicyConstStep
+	{
+		using TimePolicyConstStep::TimePolicyConstStep;
+
+		/**
+		 * @brief Time step of the bins of a level
+		 */
+		double level_time_step(size_t level) const noexcept
+		{
+			return ht * static_cast<double>(size_t{ 1 } << level);
+		}
+	};
+
+	template<typename Allocator_t>
+	using CumulativeWellKernel = CumulativeKernel<WellKernel, Allocator_t>;
+
+	template<typename Allocator_t>
+	using CumulativeFracKernel = CumulativeKernel<FracKernel, Allocator_t>;
+
+	template<size_t WellFluxCount>
+	struct MultiLevelWell :
+		public KernelMultiLevel,
+		public FluxMultiLevel
+	{
+		using Kernel = KernelMultiLevel;
+		using Flux = FluxMultiLevel;
+
+		using WellKernelType = CumulativeWellKernel<Kernel>;
+
+		using WellFluxMulti =
+			CommonFluxMulti
+			<
+				typename Flux, MultiLevelWellFlux,
+				WellFluxCount
+			>;
+
+		/**
+		 * @param spatial_size nmbr of segments
+		 * within a well
+		 *
+		 * @param frame_temporal_size nmbr of time
+		 * moments up to the external boundary
+		 *
+		 * @param bins_per_level min nmbr of bins
+		 * per level, the last bins_per_level time moments
+		 * are convolved exactly
+		 */
+		MultiLevelWell(
+			size_t spatial_size,
+			size_t frame_temporal_size,
+			size_t bins_per_level) :
+			KernelMultiLevel
+		{
+			spatial_size,
+			frame_temporal_size
+		},
+			FluxMultiLevel
+		{
+			spatial_size,
+			frame_temporal_size,
+			bins_per_level
+		}
+		{}
+	};
+
+	template<size_t WellFluxCount>
+	struct MultiLevelFrac :
+		public MultiLevelWell<WellFluxCount>
+	{
+		template<typename Allocator_t>
+		using CommonFluxMulti_Alloc =
+			CommonFluxMulti<
+				Allocator_t,
+				MultiLevelFracFlux,
+				WellFluxCount
+			>;
+
+		using FracFluxMultiContainer = FracturesFluxContainer_t<
+			typename Flux, CommonFluxMulti_Alloc>;
+
+		using FracKernelContainerType = FracKernelContainer<
+			typename Kernel, CumulativeFracKernel>;
+
+		std::vector<typename MultiLevelWell::Kernel> fracKernelRegime;
+		std::vector<typename MultiLevelWell::Flux> fracFluxRegime;
+
+		/**
+		 * @param well_spatial_size nmbr of segments
+		 * within a well
+		 *
+		 * @param frame_temporal_size total nmbr of
+		 * time moments up to the external boundary
+		 *
+		 * @param bins_per_level min nmbr of bins per level
+		 *
+		 * @param fracNy vector of nmbrs of y-nodes
+		 * along the fractures
+		 */
+		MultiLevelFrac(
+			size_t well_spatial_size,
+			size_t frame_temporal_size,
+			size_t bins_per_level,
+			const std::vector<size_t>& fracNy) :
+
+			MultiLevelWell{
+			well_spatial_size,
+			frame_temporal_size,
+			bins_per_level
+		}
+		{
+			size_t frac_nmbr = fracNy.size();
+
+			fracKernelRegime.reserve(frac_nmbr);
+			fracFluxRegime.reserve(frac_nmbr);
+
+			for (size_t frac_id = 0; frac_id < frac_nmbr; ++frac_id)
+			{
+				fracKernelRegime.emplace_back(
+					fracNy[frac_id], frame_temporal_size);
+				fracFluxRegime.emplace_back(
+					fracNy[frac_id], frame_temporal_size,
+					bins_per_level);
+			}
+		}
+	};
+
+	template<size_t WellFluxCount>
+	struct MultiLevelPolicy :
+		public MultiLevelFrac<WellFluxCount>,
+		public TimePolicyMultiLevel
+	{
+		using TimePolicy = TimePolicyMultiLevel;
+
+		MultiLevelPolicy(
+			const MultiLevelFrac<WellFluxCount>& multiLevel,
+			const TimePolicyMultiLevel& timePolicy) noexcept :
+			MultiLevelFrac<WellFluxCount>{ multiLevel },
+			TimePolicyMultiLevel{ timePolicy }
+		{}
+	};
+
+	template<size_t WellFluxCount>
+	using MultiLevel =
+		MultiLevelPolicy<WellFluxCount>;
+} // Convolution
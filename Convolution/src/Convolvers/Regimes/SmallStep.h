@@ -41,6 +41,12 @@ namespace Convolution
 			SmallStepFrac{ constStep },
 			TimePolicySmallStep{ timePolicy }
 		{}
+
+		template<typename Visitor_t>
+		void checkpoint(Visitor_t& visitor)
+		{
+			visitor.pod(static_cast<TimePolicySmallStep&>(*this));
+		}
 	};
 
 	template<size_t WellFluxCount>
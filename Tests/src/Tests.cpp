@@ -12,6 +12,33 @@ int main()
     Tests::test_onGetFluxConstStep();
     Tests::test_kernelConstStep();
     Tests::test_baseKernel_constStep();
+    Tests::test_fluxRingStep();
+    Tests::test_blockFFTConvolver();
+    Tests::test_exponentialKernel();
+    Tests::test_fluxMultiLevel();
+    Tests::test_baseKernelFile();
+    Tests::test_kernelStorageFloat();
+    Tests::test_kernelCache();
+    Tests::test_checkpointLog();
+    Tests::test_adaptiveExternalBoundary();
+    Tests::test_rowBandedKernel();
+    Tests::test_convolveByParts();
+    Tests::test_zeroAllocationStepping();
+    Tests::test_coefWriter();
+    Tests::test_fusedAdvanceConvolve();
+    Tests::test_packedFracKernels();
+    Tests::test_deterministicFracReduction();
+    Tests::test_indexedFracPush();
+    Tests::test_batchedFracPush();
+    Tests::test_kernelCoefPolicies();
+    Tests::test_interpolatedFluxMainStep();
+    Tests::test_ensembleFluxMulti();
+    Tests::test_columnPartitionedEngine();
+    Tests::test_partitionedEngines();
+    Tests::test_newtonConvolution();
+    Tests::test_mainStepBatch();
+    Tests::test_fracKernelZeroInit();
+    Tests::test_threadPoolJobs();
 }
 
 // Run program: Ctrl + F5 or Debug > Start Without Debugging menu
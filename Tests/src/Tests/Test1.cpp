@@ -1,14 +1,93 @@
 #include "Test1.h"
 
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Convolvers/Platform/AllocationCounter.h"
 #include "Convolvers/ConvolutionDefines.h"
 #include "Convolvers/Allocators/AllocatorConstStep.h"
+#include "Convolvers/Allocators/AllocatorRingStep.h"
+#include "Convolvers/Allocators/AllocatorMultiLevel.h"
+#include "Convolvers/Allocators/AllocatorMainStep.h"
 #include "Convolvers/Kernels/BaseKernel.h"
+#include "Convolvers/Kernels/FracKernel.h"
+#include "Convolvers/Kernels/CumulativeKernel.h"
+#include "Convolvers/Kernels/WellKernel.h"
+#include "Convolvers/Kernels/KernelCache.h"
+#include "Convolvers/Platform/CheckpointLog.h"
+#include "Convolvers/Regimes/ConstStep.h"
+#include "Convolvers/Fluxes/WellFlux.h"
+#include "Convolvers/Fluxes/FracFlux.h"
+#include "Convolvers/Fluxes/EnsembleFluxContainer.h"
+#include "Convolvers/Fluxes/CommonFluxMulti.h"
+#include "Convolvers/Fluxes/MultiLevelFluxContainer.h"
+#include "Convolvers/Fluxes/BaseFluxContainerMainStep.h"
+#include "Convolvers/Fluxes/InterpolatedFluxMainStep.h"
+#include "Convolvers/Engines/BlockFFTConvolver.h"
+#include "Convolvers/Kernels/ExponentialKernel.h"
 
 #include "../Factory/ClassFactory.h"
 #include "../Printers/Printers.h"
 
 namespace Tests
 {
+	namespace
+	{
+		/**
+		 * @brief A path in the temporary directory which is unique
+		 * per run, so a test removes only its own files
+		 */
+		std::filesystem::path unique_temp_path(const std::string& name)
+		{
+			std::random_device device;
+			return std::filesystem::temp_directory_path() /
+				(name + "_" + std::to_string(device()) + "_" + std::to_string(device()));
+		}
+
+		/**
+		 * @brief The max deviation of the results from the expected ones,
+		 * relative to the max of the expected ones, over all the comparisons
+		 */
+		struct RelativeError
+		{
+			double error{ 0.0 };
+			double scale{ 0.0 };
+
+			template<typename Expected_t, typename Result_t>
+			void add(const Expected_t& expected, const Result_t& result)
+			{
+				error = (std::max)(error, (result - expected).cwiseAbs().maxCoeff());
+				scale = (std::max)(scale, expected.cwiseAbs().maxCoeff());
+			}
+
+			void add(double expected, double result)
+			{
+				error = (std::max)(error, std::abs(result - expected));
+				scale = (std::max)(scale, std::abs(expected));
+			}
+
+			double value() const
+			{
+				return error / scale;
+			}
+
+			bool below(double tolerance) const
+			{
+				return error <= tolerance * scale;
+			}
+		};
+	}
+
 	bool test_memDesc()
 	{
 		size_t source_count{ 100 };
@@ -107,4 +186,1576 @@ namespace Tests
 
 		return false;
 	}
+
+	bool test_fluxRingStep()
+	{
+		size_t source_count{ 100 };
+		size_t frame_temporal_size{ 10 };
+		size_t time_intervals_count{ 35 };
+
+		Convolution::FluxRingStep ring{ source_count, frame_temporal_size };
+
+		bool result = ring.ring_capacity() >= source_count * frame_temporal_size;
+		for (size_t nt = 1; nt <= time_intervals_count; ++nt)
+		{
+			ring.pusher.on_push();
+			ring.extractor.on_extract();
+
+			size_t window = (std::min)(nt, frame_temporal_size) * source_count;
+			// the newest data is at the begin of the window
+			result = result &&
+				ring.pusher.idx_begin() == ring.extractor.idx_begin() &&
+				ring.extractor.idx_begin() < ring.ring_capacity() &&
+				ring.extractor.current_window_size() == window &&
+				ring.extractor.idx_end() <= 2 * ring.ring_capacity();
+		}
+
+		std::cout << "FluxRingStep capacity: " << ring.ring_capacity() << std::endl;
+
+		// the flux in the ring gives the same windows and convolutions
+		// as FluxConstStep, the ring is wrapped around several times
+		size_t rows_count{ 50 };
+		size_t segm_count{ 3 };
+		Convolution::FluxRingStep ringDesc{ segm_count, frame_temporal_size };
+		const size_t frames_count = 3 * ringDesc.ring_capacity() / segm_count;
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { segm_count, frame_temporal_size } };
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_ring{ rows_count, { segm_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ { segm_count, frames_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxRingStep>
+			flux_ring{ ringDesc };
+
+		std::vector<double> qzi(segm_count), perm(segm_count, 2.0);
+		RelativeError error;
+		for (size_t nt = 0; nt < frames_count; ++nt)
+		{
+			if (nt < frame_temporal_size)
+			{
+				Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, segm_count);
+				kernel.P_cur = P;
+				kernel_ring.P_cur = P;
+				kernel.advance();
+				kernel_ring.advance();
+			}
+			for (size_t segm_id = 0; segm_id < segm_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.01 * static_cast<double>(nt) + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_ring.push_coef(qzi.data(), perm.data());
+
+			const Eigen::VectorXd direct = flux.extract().convolve(kernel);
+			const Eigen::VectorXd in_ring = flux_ring.extract().convolve(kernel_ring);
+			result = result && flux() == flux_ring();
+			error.add(direct, in_ring);
+		}
+
+		std::cout << "FluxRingStep: " << frames_count
+			<< " time frames, relative error " << error.value() << std::endl;
+
+		return result && error.below(1e-12);
+	}
+
+	bool test_blockFFTConvolver()
+	{
+		size_t rows_count{ 50 };
+		size_t source_count{ 3 };
+		size_t time_intervals_count{ 100 };
+		size_t frame_temporal_size{ 37 };
+		size_t block_size{ 8 };
+		double tolerance{ 1e-10 };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_fft{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_fft{ { source_count, time_intervals_count, frame_temporal_size } };
+
+		Convolution::BlockFFTConvolver convolver{
+			rows_count, source_count, frame_temporal_size,
+			block_size, tolerance };
+
+		std::vector<double> qzi(source_count), perm(source_count, 2.0);
+		double error{ 0.0 };
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			if (nt < frame_temporal_size)
+			{
+				Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, source_count);
+				kernel.P_cur = P;
+				kernel_fft.P_cur = P;
+				kernel.advance();
+				kernel_fft.advance();
+			}
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.1 * nt + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_fft.push_coef(qzi.data(), perm.data());
+
+			Eigen::VectorXd direct = flux.extract().convolve(kernel);
+			flux_fft.extract();
+			const Eigen::VectorXd& fft = convolver.convolve(kernel_fft, flux_fft);
+			error = (std::max)(error, (direct - fft).cwiseAbs().maxCoeff());
+		}
+
+		std::cout << "BlockFFTConvolver max error: " << error << std::endl;
+
+		return error < tolerance;
+	}
+
+	bool test_exponentialKernel()
+	{
+		size_t rows_count{ 100 };
+		size_t source_count{ 2 };
+		size_t time_intervals_count{ 600 };
+		size_t frame_temporal_size{ 200 };
+		double tolerance{ 1e-6 };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_exp{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_exp{ { source_count, time_intervals_count, frame_temporal_size } };
+
+		Convolution::ExponentialKernel convolver{
+			rows_count, source_count, frame_temporal_size, tolerance };
+
+		// P(t) = a*(1 - exp(-t/5)) + b*log(1 + t/20),
+		// so the kernel P(t) - P(t-1) decays smoothly
+		Eigen::ArrayXXd a = Eigen::ArrayXXd::Random(rows_count, source_count);
+		Eigen::ArrayXXd b = Eigen::ArrayXXd::Random(rows_count, source_count);
+
+		std::vector<double> qzi(source_count), perm(source_count, 1.0);
+		RelativeError error;
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			if (nt < frame_temporal_size)
+			{
+				double t = static_cast<double>(nt + 1);
+				Eigen::ArrayXXd P =
+					a * (1.0 - std::exp(-t / 5.0)) + b * std::log(1.0 + t / 20.0);
+				kernel.P_cur = P;
+				kernel_exp.P_cur = P;
+				kernel.advance();
+				kernel_exp.advance();
+			}
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = 1.0 + std::sin(0.05 * nt + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_exp.push_coef(qzi.data(), perm.data());
+
+			Eigen::VectorXd direct = flux.extract().convolve(kernel);
+			flux_exp.extract();
+			const Eigen::VectorXd& approx = convolver.convolve(kernel_exp, flux_exp);
+			error.add(direct, approx);
+		}
+
+		std::cout << "ExponentialKernel relative error: " << error.value() << std::endl;
+
+		return convolver.is_fitted() && error.below(10.0 * tolerance);
+	}
+
+	bool test_fluxMultiLevel()
+	{
+		size_t source_count{ 10 };
+		size_t frame_temporal_size{ 1000 };
+		size_t bins_per_level{ 4 };
+		size_t time_intervals_count{ 5000 };
+
+		Convolution::FluxMultiLevel flux{
+			source_count, frame_temporal_size, bins_per_level };
+
+		bool result = true;
+		size_t max_bin_count{ 0 };
+		for (size_t nt = 1; nt <= time_intervals_count; ++nt)
+		{
+			flux.pusher.on_push();
+			flux.extractor.on_extract();
+
+			max_bin_count = (std::max)(max_bin_count, flux.pusher.bin_count());
+			result = result &&
+				flux.pusher.bin_count() == flux.extractor.bin_count() &&
+				flux.pusher.lag_span() >= (std::min)(nt, frame_temporal_size) &&
+				flux.extractor.current_window_size() ==
+					flux.extractor.bin_count() * source_count;
+		}
+
+		std::cout << "FluxMultiLevel max bin count: " << max_bin_count << std::endl;
+
+		// the convolution of the bins is exact for a flux
+		// which is constant within every bin of the last time frame,
+		// the frames are within the external boundary
+		size_t rows_count{ 200 };
+		size_t frames_count{ 120 };
+		Convolution::FluxMultiLevel layout{
+			source_count, frame_temporal_size, bins_per_level };
+		for (size_t nt = 1; nt <= frames_count; ++nt)
+			layout.pusher.on_push();
+		// the bin of a lag at the last time frame
+		std::vector<size_t> lag_bin;
+		for (size_t level = 0, bin_id = 0; level < layout.pusher.level_count(); ++level)
+			for (size_t id = 0; id < layout.pusher.level_bin_count(level); ++id, ++bin_id)
+				lag_bin.insert(lag_bin.end(), size_t{ 1 } << level, bin_id);
+		const Eigen::MatrixXd bin_flux = Eigen::MatrixXd::Random(
+			source_count, layout.pusher.bin_count()).array() + 2.0;
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frames_count } };
+		Convolution::CumulativeKernel<Convolution::WellKernel, Convolution::KernelMultiLevel>
+			kernel_cumulative{ rows_count, { source_count, frames_count } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_direct{ { source_count, frames_count, frames_count } };
+		Convolution::MultiLevelWellFlux<Convolution::FluxMultiLevel>
+			flux_levels{ { source_count, frame_temporal_size, bins_per_level } };
+
+		std::vector<double> perm(source_count, 2.0);
+		Eigen::VectorXd direct, levels;
+		for (size_t nt = 1; nt <= frames_count; ++nt)
+		{
+			Eigen::ArrayXXd P =
+				Eigen::ArrayXXd::Random(rows_count, source_count) +
+				std::sqrt(static_cast<double>(nt));
+			kernel.P_cur = P;
+			kernel_cumulative.P_cur = P;
+			kernel.advance();
+			kernel_cumulative.advance();
+
+			const Eigen::VectorXd qzi = bin_flux.col(
+				static_cast<Eigen::Index>(lag_bin[frames_count - nt]));
+			flux_direct.push_coef(qzi.data(), perm.data());
+			flux_levels.push_coef(qzi.data(), perm.data());
+
+			direct = flux_direct.extract().convolve(kernel);
+			levels = flux_levels.extract().convolve(kernel_cumulative);
+		}
+		RelativeError error;
+		error.add(direct, levels);
+
+		std::cout << "FluxMultiLevel convolution: "
+			<< lag_bin.size() << " lags in " << layout.pusher.bin_count()
+			<< " bins, relative error " << error.value() << std::endl;
+
+		return result && max_bin_count < flux.bin_capacity() &&
+			lag_bin.size() == frames_count &&
+			error.below(1e-12);
+	}
+
+	bool test_baseKernelFile()
+	{
+		size_t rows_count{ 1000 };
+		size_t source_count{ 10 };
+		size_t frame_temporal_size{ 20 };
+
+		// the files are in the temporary directory by default
+		const std::string directory = Convolution::KernelStorageFile::directory();
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseKernelFile<Convolution::KernelConstStep>
+			kernel_file{ rows_count, { source_count, frame_temporal_size }, "TestKernel" };
+		Convolution::WellKernelFile<Convolution::KernelConstStep>
+			well_file{ rows_count, { source_count, frame_temporal_size } };
+
+		for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+		{
+			Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, source_count);
+			kernel.P_cur = P;
+			kernel_file.P_cur = P;
+			well_file.P_cur = P;
+			kernel.advance();
+			kernel_file.advance();
+			well_file.advance();
+		}
+
+		// a kernel is not kept in RAM silently,
+		// while a WellKernel is in RAM unless it is a WellKernelFile
+		bool thrown{ false };
+		bool well_thrown{ false };
+		bool well_in_ram{ true };
+		Convolution::KernelStorageFile::set_directory("");
+		try
+		{
+			Convolution::BaseKernelFile<Convolution::KernelConstStep>
+				kernel_anonymous{ rows_count, { source_count, frame_temporal_size }, "TestKernel" };
+		}
+		catch (const std::runtime_error&)
+		{
+			thrown = true;
+		}
+		try
+		{
+			Convolution::WellKernelFile<Convolution::KernelConstStep>
+				well_anonymous{ rows_count, { source_count, frame_temporal_size } };
+		}
+		catch (const std::runtime_error&)
+		{
+			well_thrown = true;
+		}
+		try
+		{
+			Convolution::WellKernel<Convolution::KernelConstStep>
+				well{ rows_count, { source_count, frame_temporal_size } };
+		}
+		catch (const std::runtime_error&)
+		{
+			well_in_ram = false;
+		}
+		Convolution::KernelStorageFile::set_directory(directory);
+
+		const Eigen::MatrixXd window = kernel();
+		return !directory.empty() && thrown && well_thrown && well_in_ram &&
+			(window - kernel_file()).cwiseAbs().maxCoeff() == 0.0 &&
+			(window - well_file()).cwiseAbs().maxCoeff() == 0.0;
+	}
+
+	bool test_kernelStorageFloat()
+	{
+		size_t rows_count{ 1000 };
+		size_t source_count{ 10 };
+		size_t frame_temporal_size{ 20 };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseKernel<Convolution::KernelConstStep, Convolution::KernelStorageFloat>
+			kernel_float{ rows_count, { source_count, frame_temporal_size } };
+
+		for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+		{
+			Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, source_count);
+			kernel.P_cur = P;
+			kernel_float.P_cur = P;
+			kernel.advance();
+			kernel_float.advance();
+		}
+
+		const auto window = kernel();
+		const auto window_float = kernel_float();
+		Eigen::VectorXd flux = Eigen::VectorXd::Random(window.cols());
+		Eigen::VectorXd out, out_float;
+		Convolution::SequentialEngine::convolve(window, flux, out);
+		Convolution::SequentialEngine::convolve(window_float, flux, out_float);
+
+		const Convolution::KernelPrecisionReport& report =
+			kernel_float.precision_report();
+		// the error of the sum is bounded by
+		// the errors of the coefficients
+		const double bound = report.max_abs_error * flux.lpNorm<1>();
+		return report.values == rows_count * source_count * frame_temporal_size &&
+			report.max_rel_error() < 1e-7 &&
+			(out - out_float).cwiseAbs().maxCoeff() <= bound;
+	}
+
+	bool test_kernelCache()
+	{
+		size_t rows_count{ 1000 };
+		size_t source_count{ 10 };
+		size_t frame_temporal_size{ 20 };
+		size_t cached_steps{ 12 };
+
+		Convolution::KernelCache cache{
+			unique_temp_path("ConvolutionKernelCache").string() };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		for (size_t nt = 0; nt < cached_steps; ++nt)
+		{
+			kernel.P_cur = Eigen::ArrayXXd::Random(rows_count, source_count);
+			kernel.advance();
+		}
+		const Convolution::KernelCacheKey key =
+			Convolution::KernelCacheKey::of(
+				"TestKernel", kernel, "test geometry",
+				std::vector<double>(cached_steps, 0.1));
+		cache.save(key, kernel);
+
+		// the entry is read into the own storage of a kernel,
+		// the file kernel stays in its scratch file
+		Convolution::BaseKernelFile<Convolution::KernelConstStep>
+			kernel_file{ rows_count, { source_count, frame_temporal_size }, "TestKernel" };
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_ram{ rows_count, { source_count, frame_temporal_size } };
+		const double* file_pages = kernel_file.Kernel.data();
+		bool loaded =
+			cache.load(key, kernel_file) &&
+			kernel_file.Kernel.data() == file_pages &&
+			cache.load(key, kernel_ram) &&
+			!cache.load(key.part(1), kernel_ram);
+
+		// bfloat16 and half are of the same width,
+		// an entry of the one is not loaded into the other
+		Convolution::BaseKernel<Convolution::KernelConstStep, Convolution::KernelStorageBFloat16>
+			kernel_bf16{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseKernel<Convolution::KernelConstStep, Convolution::KernelStorageHalf>
+			kernel_half{ rows_count, { source_count, frame_temporal_size } };
+		kernel_bf16.P_cur = Eigen::ArrayXXd::Random(rows_count, source_count);
+		kernel_bf16.advance();
+		const Convolution::KernelCacheKey key_bf16 =
+			Convolution::KernelCacheKey::of(
+				"TestKernel", kernel_bf16, "test geometry",
+				std::vector<double>(1, 0.1));
+		const Convolution::KernelCacheKey key_half =
+			Convolution::KernelCacheKey::of(
+				"TestKernel", kernel_half, "test geometry",
+				std::vector<double>(1, 0.1));
+		cache.save(key_bf16, kernel_bf16);
+		loaded = loaded &&
+			key_bf16.value() != key_half.value() &&
+			!cache.load(key_bf16, kernel_half);
+
+		for (size_t nt = cached_steps; nt < frame_temporal_size; ++nt)
+		{
+			Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, source_count);
+			kernel.P_cur = P;
+			kernel_file.P_cur = P;
+			kernel_ram.P_cur = P;
+			kernel.advance();
+			kernel_file.advance();
+			kernel_ram.advance();
+		}
+
+		std::filesystem::remove_all(cache.directory());
+
+		const auto window = kernel();
+		return loaded &&
+			(window - kernel_file()).cwiseAbs().maxCoeff() == 0.0 &&
+			(window - kernel_ram()).cwiseAbs().maxCoeff() == 0.0;
+	}
+
+	bool test_checkpointLog()
+	{
+		size_t rows_count{ 50 };
+		size_t source_count{ 3 };
+		size_t time_intervals_count{ 40 };
+		size_t frame_temporal_size{ 30 };
+		size_t restart_time{ 17 };
+		size_t checkpoint_period{ 5 };
+
+		const std::string path = unique_temp_path("ConvolutionCheckpoint.log").string();
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::TimePolicyConstStep time{ 0.1 };
+
+		std::vector<double> qzi(source_count), perm(source_count, 2.0);
+		auto step = [&](
+			Convolution::BaseKernel<Convolution::KernelConstStep>& k,
+			Convolution::BaseWellFlux<Convolution::FluxConstStep>& f,
+			Convolution::TimePolicyConstStep& t,
+			size_t nt)
+		{
+			t.set_interval();
+			if (nt < frame_temporal_size)
+			{
+				k.P_cur = Eigen::ArrayXXd::Constant(rows_count, source_count, std::exp(-0.1 * nt));
+				k.advance();
+			}
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.1 * nt + segm_id);
+			f.push_coef(qzi.data(), perm.data());
+			return f.extract().convolve(k);
+		};
+
+		{
+			Convolution::CheckpointLog log{ path };
+			for (size_t nt = 0; nt < restart_time; ++nt)
+			{
+				step(kernel, flux, time, nt);
+				if ((nt + 1) % checkpoint_period == 0)
+					log.write(kernel, flux, time);
+			}
+		}
+
+		// the simulation is restarted from the last checkpoint
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_restored{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_restored{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::TimePolicyConstStep time_restored{ 0.1 };
+		Convolution::CheckpointLog log{ path };
+		bool restored = log.restore(kernel_restored, flux_restored, time_restored);
+		const size_t checkpoint_time = log.checkpoint_count() * checkpoint_period;
+
+		// the original simulation is replayed from the checkpoint
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_replayed{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_replayed{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::TimePolicyConstStep time_replayed{ 0.1 };
+		for (size_t nt = 0; nt < checkpoint_time; ++nt)
+			step(kernel_replayed, flux_replayed, time_replayed, nt);
+
+		double error{ 0.0 };
+		for (size_t nt = checkpoint_time; nt < time_intervals_count; ++nt)
+		{
+			Eigen::VectorXd replayed = step(kernel_replayed, flux_replayed, time_replayed, nt);
+			Eigen::VectorXd continued = step(kernel_restored, flux_restored, time_restored, nt);
+			error = (std::max)(error, (replayed - continued).cwiseAbs().maxCoeff());
+		}
+
+		std::filesystem::remove(path);
+
+		return restored &&
+			checkpoint_time == 15 &&
+			time_restored.currentTime() == time_replayed.currentTime() &&
+			error == 0.0;
+	}
+
+	bool test_adaptiveExternalBoundary()
+	{
+		size_t rows_count{ 100 };
+		size_t source_count{ 3 };
+		size_t time_intervals_count{ 120 };
+		// an over-estimated frame
+		size_t frame_temporal_size{ 80 };
+		double tolerance{ 1e-6 };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_adaptive{ rows_count, { source_count, frame_temporal_size } };
+		kernel_adaptive.set_external_boundary_tolerance(tolerance);
+		// the pages beyond the boundary are released
+		Convolution::BaseKernelFile<Convolution::KernelConstStep>
+			kernel_file{ rows_count, { source_count, frame_temporal_size }, "TestKernel" };
+		kernel_file.set_external_boundary_tolerance(tolerance);
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_adaptive{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_file{ { source_count, time_intervals_count, frame_temporal_size } };
+
+		std::vector<double> qzi(source_count), perm(source_count, 1.0);
+		RelativeError error;
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			if (nt < frame_temporal_size)
+			{
+				// the lag blocks decay as exp(-0.5 * lag)
+				Eigen::ArrayXXd P = Eigen::ArrayXXd::Constant(
+					rows_count, source_count, 1.0 - std::exp(-0.5 * (nt + 1)));
+				kernel.P_cur = P;
+				kernel_adaptive.P_cur = P;
+				kernel_file.P_cur = P;
+				kernel.advance();
+				kernel_adaptive.advance();
+				kernel_file.advance();
+			}
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.1 * nt + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_adaptive.push_coef(qzi.data(), perm.data());
+			flux_file.push_coef(qzi.data(), perm.data());
+
+			Eigen::VectorXd full = flux.extract().convolve(kernel);
+			Eigen::VectorXd adaptive = flux_adaptive.extract().convolve(kernel_adaptive);
+			Eigen::VectorXd in_file = flux_file.extract().convolve(kernel_file);
+			error.add(full, adaptive);
+			error.add(full, in_file);
+		}
+
+		std::cout << "Adaptive external boundary: "
+			<< kernel_adaptive.cols() / source_count << " of "
+			<< frame_temporal_size << " lags, relative error "
+			<< error.value() << std::endl;
+
+		return kernel_adaptive.is_external_boundary() &&
+			kernel_adaptive.Kernel.cols() < kernel.Kernel.cols() &&
+			kernel_file.is_external_boundary() &&
+			kernel_file.stored_cols() == kernel_adaptive.stored_cols() &&
+			error.below(10.0 * tolerance);
+	}
+
+	bool test_rowBandedKernel()
+	{
+		size_t rows_count{ 5000 };
+		size_t source_count{ 3 };
+		size_t time_intervals_count{ 60 };
+		size_t frame_temporal_size{ 40 };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_banded{ rows_count, { source_count, frame_temporal_size } };
+		kernel_banded.enable_row_bands();
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_banded{ { source_count, time_intervals_count, frame_temporal_size } };
+
+		std::vector<double> qzi(source_count), perm(source_count, 1.0);
+		RelativeError error;
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			if (nt < frame_temporal_size)
+			{
+				// the front reaches 100 more rows at every time step
+				const Eigen::Index front = (std::min)(
+					static_cast<Eigen::Index>(100 * (nt + 1)),
+					static_cast<Eigen::Index>(rows_count));
+				Eigen::ArrayXXd P = Eigen::ArrayXXd::Zero(rows_count, source_count);
+				P.topRows(front) = Eigen::ArrayXXd::Random(front, source_count) + 1.0;
+				kernel.P_cur = P;
+				kernel_banded.P_cur = P;
+				kernel.advance();
+				kernel_banded.advance();
+			}
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.1 * nt + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_banded.push_coef(qzi.data(), perm.data());
+
+			Eigen::VectorXd dense = flux.extract().convolve(kernel);
+			Eigen::VectorXd banded = flux_banded.extract().convolve(kernel_banded);
+			error.add(dense, banded);
+		}
+
+		// share of the coefficients multiplied
+		double multiplied{ 0.0 };
+		for (const auto& group : kernel_banded.band_groups(0, kernel_banded.cols()))
+			multiplied += static_cast<double>(group.row_count * group.col_count);
+		multiplied /= static_cast<double>(rows_count * kernel_banded.cols());
+
+		std::cout << "Row banded kernel: " << multiplied
+			<< " of the coefficients multiplied, relative error "
+			<< error.value() << std::endl;
+
+		return multiplied < 0.6 && error.below(1e-12);
+	}
+
+	bool test_convolveByParts()
+	{
+		size_t rows_count{ 200 };
+		size_t source_count{ 3 };
+		size_t time_intervals_count{ 90 };
+		size_t frame_temporal_size{ 60 };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::CumulativeKernel<Convolution::WellKernel, Convolution::KernelConstStep>
+			kernel_cumulative{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_by_parts{ { source_count, time_intervals_count, frame_temporal_size } };
+
+		std::vector<double> qzi(source_count), perm(source_count, 2.0);
+		RelativeError error;
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			if (nt < frame_temporal_size)
+			{
+				Eigen::ArrayXXd P =
+					Eigen::ArrayXXd::Random(rows_count, source_count) +
+					std::sqrt(static_cast<double>(nt + 1));
+				kernel.P_cur = P;
+				kernel_cumulative.P_cur = P;
+				kernel.advance();
+				kernel_cumulative.advance();
+			}
+			// the rates are changed every 15 time steps
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = 1.0 + static_cast<double>((nt / 15 + segm_id) % 4);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_by_parts.push_coef(qzi.data(), perm.data());
+
+			Eigen::VectorXd direct = flux.extract().convolve(kernel);
+			Eigen::VectorXd by_parts =
+				flux_by_parts.extract().convolve_by_parts(kernel_cumulative);
+			error.add(direct, by_parts);
+		}
+
+		std::cout << "Convolution by parts: relative error "
+			<< error.value() << std::endl;
+
+		return error.below(1e-12);
+	}
+
+	bool test_zeroAllocationStepping()
+	{
+		size_t rows_count{ 3000 };
+		size_t source_count{ 3 };
+		size_t time_intervals_count{ 50 };
+		size_t frame_temporal_size{ 30 };
+		// the buffers get their sizes at the first steps
+		size_t warm_up_count{ 2 };
+
+		using Kernel = Convolution::BaseKernel<Convolution::KernelConstStep>;
+		Convolution::KernelConstStep kernelDesc{ source_count, frame_temporal_size };
+		std::array<Kernel, 2> kernels{ {
+			{ rows_count, kernelDesc },
+			{ rows_count, kernelDesc } } };
+		Convolution::CommonFluxMulti<
+			Convolution::FluxConstStep, Convolution::BaseWellFlux, 2>
+			flux{ { source_count, time_intervals_count, frame_temporal_size } };
+
+		std::vector<double> qzi(source_count), perm(source_count, 1.0);
+		Convolution::AllocationCounter counter;
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			if (nt == warm_up_count)
+				counter = Convolution::AllocationCounter{};
+			if (nt < frame_temporal_size)
+				for (size_t id = 0; id < kernels.size(); ++id)
+				{
+					// P_cur is filled in in place
+					kernels[id].P_cur.setConstant(
+						(1.0 + id) * (1.0 - std::exp(-0.1 * (nt + 1))));
+					kernels[id].advance();
+				}
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.1 * nt + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux.convolve(kernels);
+		}
+
+		std::cout << "Allocations after warm-up: "
+			<< counter.allocations() << std::endl;
+
+		return counter.allocations() == 0ull;
+	}
+
+	bool test_coefWriter()
+	{
+		size_t rows_count{ 50 };
+		size_t source_count{ 4 };
+		size_t frame_temporal_size{ 10 };
+		Convolution::KernelConstStep kernelDesc{ source_count, frame_temporal_size };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, kernelDesc }, kernel_writer{ rows_count, kernelDesc };
+		Convolution::FracKernel<Convolution::KernelConstStep>
+			frac{ rows_count, kernelDesc }, frac_writer{ rows_count, kernelDesc };
+
+		Eigen::ArrayXXd E(rows_count, source_count), f(rows_count, source_count);
+		Eigen::ArrayXXd U(rows_count, source_count);
+		Eigen::ArrayXd R(rows_count);
+		for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+		{
+			E.setRandom();
+			f.setRandom();
+			// the coefficients are copied
+			kernel.P_cur = E;
+			kernel.F = f;
+			// the generator writes right into the kernel
+			auto writer = kernel_writer.coef_writer();
+			writer.P_cur = E;
+			writer.F = f;
+			kernel_writer.commit_coef();
+			kernel.advance();
+			kernel_writer.advance();
+
+			// two terms per time step
+			for (size_t term = 0; term < 2; ++term)
+			{
+				U.setRandom();
+				R.setRandom();
+				frac.push_coef(R.data(), U.data());
+				frac_writer.coef_writer().P_cur = U;
+				frac_writer.commit_coef(R.data());
+			}
+			frac.advance();
+			frac_writer.advance();
+		}
+
+		const bool equal =
+			kernel.Kernel.leftCols(kernel.cols()) ==
+			kernel_writer.Kernel.leftCols(kernel_writer.cols()) &&
+			frac.Kernel.leftCols(frac.cols()) ==
+			frac_writer.Kernel.leftCols(frac_writer.cols());
+
+		std::cout << "Coefficient writer: "
+			<< (equal ? "same kernels" : "kernels differ") << std::endl;
+
+		return equal;
+	}
+
+	bool test_fusedAdvanceConvolve()
+	{
+		size_t rows_count{ 5000 };
+		size_t source_count{ 3 };
+		size_t frame_temporal_size{ 40 };
+		Convolution::KernelConstStep kernelDesc{ source_count, frame_temporal_size };
+		Convolution::FluxConstStep fluxDesc{ source_count, frame_temporal_size, frame_temporal_size };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, kernelDesc }, kernel_fused{ rows_count, kernelDesc };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ fluxDesc }, flux_fused{ fluxDesc };
+
+		std::vector<double> qzi(source_count), perm(source_count, 1.0);
+		Eigen::ArrayXXd P(rows_count, source_count), f(rows_count, source_count);
+		Eigen::VectorXd direct, fused;
+		RelativeError error;
+		for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+		{
+			P.setRandom();
+			f.setRandom();
+			kernel.P_cur = P;
+			kernel.F = f;
+			kernel_fused.P_cur = P;
+			kernel_fused.F = f;
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.1 * nt + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_fused.push_coef(qzi.data(), perm.data());
+
+			kernel.advance();
+			flux.extract().convolve_into(kernel, direct);
+			flux_fused.extract().advance_convolve_into(kernel_fused, fused);
+			error.add(direct, fused);
+		}
+
+		const bool same_kernel =
+			kernel.Kernel.leftCols(kernel.cols()) ==
+			kernel_fused.Kernel.leftCols(kernel_fused.cols());
+
+		std::cout << "Fused advance and convolution: relative error "
+			<< error.value()
+			<< (same_kernel ? ", same kernels" : ", kernels differ") << std::endl;
+
+		return same_kernel && error.below(1e-12);
+	}
+
+	bool test_packedFracKernels()
+	{
+		size_t rows_count{ 2000 };
+		size_t time_intervals_count{ 12 };
+		// nmbr of nodes and allocated lags per fracture,
+		// the lags beyond the time steps are not multiplied
+		std::vector<size_t> frac_nodes{ 3, 5, 4 };
+		std::vector<size_t> frac_frames{ 12, 15, 13 };
+
+		std::vector<Convolution::KernelConstStep> kernelDescs;
+		std::vector<Convolution::FluxConstStep> fluxDescs;
+		for (size_t frac_id = 0; frac_id < frac_nodes.size(); ++frac_id)
+		{
+			kernelDescs.push_back({ frac_nodes[frac_id], frac_frames[frac_id] });
+			fluxDescs.push_back({ frac_nodes[frac_id], frac_frames[frac_id], frac_frames[frac_id] });
+		}
+
+		Convolution::FracKernelContainer<Convolution::KernelConstStep>
+			kernels{ kernelDescs, rows_count };
+		Convolution::PackedFracKernelContainer<Convolution::KernelConstStep>
+			kernels_packed{ kernelDescs, rows_count };
+		Convolution::FracturesFluxContainer_t<
+			Convolution::FluxConstStep, Convolution::BaseFracFlux>
+			flux{ fluxDescs }, flux_packed{ fluxDescs };
+
+		Eigen::ArrayXXd U;
+		Eigen::ArrayXd R(rows_count);
+		std::vector<double> qzf;
+		RelativeError error;
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			for (size_t nodes : frac_nodes)
+			{
+				// two terms per time step
+				for (size_t term = 0; term < 2; ++term)
+				{
+					U.setRandom(rows_count, nodes);
+					R.setRandom();
+					kernels.push_coef(R.data(), U.data());
+					kernels_packed.push_coef(R.data(), U.data());
+				}
+				kernels.push_done();
+				kernels_packed.push_done();
+
+				qzf.resize(nodes);
+				for (size_t node = 0; node < nodes; ++node)
+					qzf[node] = std::sin(0.1 * nt + node);
+				flux.push_coef(qzf.data(), 2.0);
+				flux_packed.push_coef(qzf.data(), 2.0);
+			}
+			kernels.advance();
+			kernels_packed.advance();
+
+			const Eigen::VectorXd separate = flux.convolve(kernels);
+			const Eigen::VectorXd& packed = flux_packed.convolve(kernels_packed);
+			error.add(separate, packed);
+		}
+
+		std::cout << "Packed fracture kernels: "
+			<< kernels_packed.packed_kernel().cols() << " cols by "
+			<< kernels_packed.lag_width() << " per lag, relative error "
+			<< error.value() << std::endl;
+
+		return kernels_packed.lag_width() == 12 &&
+			kernels_packed.packed_kernel().cols() == 15 * 12 &&
+			error.below(1e-12);
+	}
+
+	bool test_deterministicFracReduction()
+	{
+		size_t rows_count{ 5000 };
+		size_t frame_temporal_size{ 8 };
+		size_t leaf_count{ 4 };
+		// fractures of very different sizes
+		std::vector<size_t> frac_nodes{ 2, 30, 3, 4, 25, 1, 6, 12, 2 };
+
+		std::vector<Convolution::KernelConstStep> kernelDescs;
+		std::vector<Convolution::FluxConstStep> fluxDescs;
+		for (size_t nodes : frac_nodes)
+		{
+			kernelDescs.push_back({ nodes, frame_temporal_size });
+			fluxDescs.push_back({ nodes, frame_temporal_size, frame_temporal_size });
+		}
+
+		// the same time steps are convolved at every run
+		auto run = [&](size_t leaves, size_t thread_count)
+		{
+#ifdef POOL_CODE
+			Convolution::ThreadPool::instance().set_thread_count(thread_count);
+#endif
+			Convolution::FracKernelContainer<Convolution::KernelConstStep>
+				kernels{ kernelDescs, rows_count };
+			Convolution::FracturesFluxContainer_t<
+				Convolution::FluxConstStep, Convolution::BaseFracFlux>
+				flux{ fluxDescs };
+			flux.set_parallel_reduction(leaves);
+
+			std::srand(7u);
+			Eigen::ArrayXXd U;
+			Eigen::ArrayXd R(rows_count);
+			std::vector<double> qzf;
+			Eigen::VectorXd result;
+			for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+			{
+				for (size_t nodes : frac_nodes)
+				{
+					U.setRandom(rows_count, nodes);
+					R.setRandom();
+					kernels.push_coef(R.data(), U.data());
+					kernels.push_done();
+
+					qzf.resize(nodes);
+					for (size_t node = 0; node < nodes; ++node)
+						qzf[node] = std::sin(0.1 * nt + node);
+					flux.push_coef(qzf.data(), 2.0);
+				}
+				kernels.advance();
+				result = flux.convolve(kernels);
+			}
+			return result;
+		};
+
+#ifdef POOL_CODE
+		const size_t pool_threads = Convolution::ThreadPool::instance().thread_count();
+#else
+		const size_t pool_threads = 1;
+#endif
+		const Eigen::VectorXd sequential = run(0, pool_threads);
+		const Eigen::VectorXd reference = run(leaf_count, 1);
+		bool same_bits = true;
+		for (size_t thread_count : { 2, 3, 8 })
+		{
+			const Eigen::VectorXd tree = run(leaf_count, thread_count);
+			same_bits = same_bits && tree.size() == reference.size() &&
+				std::memcmp(tree.data(), reference.data(),
+					sizeof(double) * static_cast<size_t>(tree.size())) == 0;
+		}
+#ifdef POOL_CODE
+		Convolution::ThreadPool::instance().set_thread_count(pool_threads);
+#endif
+
+		const double error =
+			(sequential - reference).cwiseAbs().maxCoeff() /
+			sequential.cwiseAbs().maxCoeff();
+		std::cout << "Deterministic fracture reduction: "
+			<< (same_bits ? "same bits" : "bits differ")
+			<< " for 1, 2, 3, 8 threads, relative error "
+			<< error << std::endl;
+
+		return same_bits && error <= 1e-12;
+	}
+
+	bool test_indexedFracPush()
+	{
+		size_t rows_count{ 1000 };
+		size_t frame_temporal_size{ 6 };
+		size_t thread_count{ 3 };
+		std::vector<size_t> frac_nodes{ 4, 2, 7, 3, 5 };
+		const size_t frac_count = frac_nodes.size();
+
+		std::vector<Convolution::KernelConstStep> kernelDescs;
+		std::vector<Convolution::FluxConstStep> fluxDescs;
+		for (size_t nodes : frac_nodes)
+		{
+			kernelDescs.push_back({ nodes, frame_temporal_size });
+			// a step more for the incomplete push
+			fluxDescs.push_back({ nodes, frame_temporal_size + 1, frame_temporal_size });
+		}
+
+		Convolution::FracKernelContainer<Convolution::KernelConstStep>
+			kernels{ kernelDescs, rows_count }, kernels_indexed{ kernelDescs, rows_count };
+		Convolution::FracturesFluxContainer_t<
+			Convolution::FluxConstStep, Convolution::BaseFracFlux>
+			flux{ fluxDescs }, flux_indexed{ fluxDescs };
+
+		// the coefficients of a time step, per fracture
+		std::vector<Eigen::ArrayXXd> U(frac_count);
+		std::vector<Eigen::ArrayXd> R(frac_count);
+		std::vector<std::vector<double>> qzf(frac_count);
+		double error{ 0.0 };
+		for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+		{
+			for (size_t frac_id = 0; frac_id < frac_count; ++frac_id)
+			{
+				U[frac_id].setRandom(rows_count, frac_nodes[frac_id]);
+				R[frac_id].setRandom(rows_count);
+				qzf[frac_id].resize(frac_nodes[frac_id]);
+				for (size_t node = 0; node < frac_nodes[frac_id]; ++node)
+					qzf[frac_id][node] = std::sin(0.1 * nt + node + frac_id);
+
+				kernels.push_coef(R[frac_id].data(), U[frac_id].data());
+				kernels.push_done();
+				flux.push_coef(qzf[frac_id].data(), 2.0);
+			}
+
+			// every thread pushes its fractures from the last one
+			std::vector<std::thread> threads;
+			for (size_t thread = 0; thread < thread_count; ++thread)
+				threads.emplace_back([&, thread]()
+					{
+						for (size_t frac_id = frac_count; frac_id-- > 0;)
+						{
+							if (frac_id % thread_count != thread)
+								continue;
+							kernels_indexed.push_coef(
+								frac_id, R[frac_id].data(), U[frac_id].data());
+							kernels_indexed.push_done(frac_id);
+							flux_indexed.push_coef(frac_id, qzf[frac_id].data(), 2.0);
+						}
+					});
+			for (auto& thread : threads)
+				thread.join();
+
+			kernels.advance();
+			kernels_indexed.advance();
+			const Eigen::VectorXd round_robin = flux.convolve(kernels);
+			const Eigen::VectorXd indexed = flux_indexed.convolve(kernels_indexed);
+			error = (std::max)(error, (round_robin - indexed).cwiseAbs().maxCoeff());
+			// the barrier is passed again within the time step
+			const Eigen::VectorXd& repeated = flux_indexed.convolve(kernels_indexed);
+			error = (std::max)(error, (repeated - indexed).cwiseAbs().maxCoeff());
+		}
+
+		// the last fracture is not pushed
+		bool reported{ false };
+		for (size_t frac_id = 0; frac_id + 1 < frac_count; ++frac_id)
+			flux_indexed.push_coef(frac_id, qzf[frac_id].data(), 2.0);
+		try
+		{
+			flux_indexed.convolve(kernels_indexed);
+		}
+		catch (const std::runtime_error& e)
+		{
+			reported = true;
+			std::cout << e.what() << std::endl;
+		}
+
+		std::cout << "Indexed fracture push: max difference "
+			<< error << std::endl;
+
+		return error == 0.0 && reported;
+	}
+
+	bool test_batchedFracPush()
+	{
+		// more rows than a tile of push_coefs()
+		size_t rows_count{ 5000 };
+		size_t source_count{ 3 };
+		size_t frame_temporal_size{ 8 };
+		size_t term_count{ 4 };
+		Convolution::KernelConstStep kernelDesc{ source_count, frame_temporal_size };
+
+		Convolution::FracKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, kernelDesc }, kernel_batched{ rows_count, kernelDesc };
+
+		std::vector<Eigen::ArrayXXd> U(term_count);
+		std::vector<Eigen::ArrayXd> R(term_count);
+		std::vector<const double*> U_data(term_count), R_data(term_count);
+		for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+		{
+			for (size_t term = 0; term < term_count; ++term)
+			{
+				U[term].setRandom(rows_count, source_count);
+				R[term].setRandom(rows_count);
+				U_data[term] = U[term].data();
+				R_data[term] = R[term].data();
+				kernel.push_coef(R_data[term], U_data[term]);
+			}
+			kernel_batched.push_coefs(R_data.data(), U_data.data(), term_count);
+			kernel.advance();
+			kernel_batched.advance();
+		}
+
+		const bool equal =
+			kernel.Kernel.leftCols(kernel.cols()) ==
+			kernel_batched.Kernel.leftCols(kernel_batched.cols()) &&
+			(kernel.P_prev == kernel_batched.P_prev).all();
+
+		std::cout << "Batched fracture push: "
+			<< (equal ? "same kernels" : "kernels differ") << std::endl;
+
+		return equal;
+	}
+
+	bool test_kernelCoefPolicies()
+	{
+		size_t rows_count{ 300 };
+		size_t source_count{ 4 };
+		size_t frame_temporal_size{ 10 };
+		Convolution::KernelConstStep kernelDesc{ source_count, frame_temporal_size };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, kernelDesc };
+		Convolution::ReflectionKernel<Convolution::KernelConstStep>
+			kernel_reflection{ rows_count, kernelDesc };
+		Convolution::FracKernel<Convolution::KernelConstStep>
+			frac{ rows_count, kernelDesc };
+
+		for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+		{
+			Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, source_count);
+			kernel.P_cur = P;
+			kernel_reflection.P_cur = P;
+			kernel.advance();
+			kernel_reflection.advance();
+		}
+
+		const bool equal =
+			kernel.Kernel.leftCols(kernel.cols()) ==
+			kernel_reflection.Kernel.leftCols(kernel_reflection.cols());
+		// F is stored by the full kernel only
+		constexpr bool elided =
+			std::is_same<decltype(kernel_reflection.F), Convolution::ElidedCoefs>::value &&
+			std::is_same<decltype(frac.F), Convolution::ElidedCoefs>::value;
+
+		std::cout << "Kernel coefficient policies: F of "
+			<< kernel.F.size() << " coefs is "
+			<< (elided ? "not stored" : "stored")
+			<< " for the reflections and the fractures, "
+			<< (equal ? "same kernels" : "kernels differ") << std::endl;
+
+		return equal && elided;
+	}
+
+	bool test_interpolatedFluxMainStep()
+	{
+		size_t source_count{ 3 };
+		size_t main_step_nmbr{ 8 };
+		size_t frame_temporal_size{ 5 };
+		size_t small_step_nmbr{ 4 };
+
+		Convolution::FluxMainStep allocator{
+			source_count, main_step_nmbr, frame_temporal_size, small_step_nmbr };
+		Convolution::BaseWellFluxMainStep<Convolution::FluxMainStep>
+			flux{ allocator };
+		Convolution::InterpolatedWellFluxMainStep<Convolution::FluxMainStep>
+			flux_interpolated{ allocator };
+
+		std::vector<double> qzi(source_count), perm(source_count, 2.0);
+		double error{ 0.0 };
+		auto compare = [&](const auto& window, const auto& window_interpolated)
+		{
+			if (window.size() != window_interpolated.size())
+				error = 1.0;
+			else
+				error = (std::max)(error,
+					(window - window_interpolated).cwiseAbs().maxCoeff());
+		};
+
+		// first part of the history: the raw windows
+		for (size_t nt = 0; nt < main_step_nmbr; ++nt)
+		{
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.3 * nt + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_interpolated.push_coef(qzi.data(), perm.data());
+			compare(flux.extract()(), flux_interpolated.extract()());
+		}
+
+		// second part of the history: the averaged windows
+		for (size_t step_id = 0; step_id < 2 * small_step_nmbr; ++step_id)
+		{
+			compare(flux.extract()(), flux_interpolated.extract()());
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				error = (std::max)(error, std::abs(
+					flux(main_step_nmbr + step_id + 1, segm_id) -
+					flux_interpolated(main_step_nmbr + step_id + 1, segm_id)));
+		}
+
+		// all the small steps of a main step at once
+		const Eigen::MatrixXd& main_step = flux.extract_main_step();
+		for (size_t step_id = 0; step_id < small_step_nmbr; ++step_id)
+			compare(main_step.col(step_id), flux_interpolated.view(step_id)());
+
+		std::cout << "InterpolatedFluxMainStep max error: " << error << std::endl;
+
+		return error < 1e-15;
+	}
+
+	bool test_ensembleFluxMulti()
+	{
+		size_t rows_count{ 100 };
+		size_t source_count{ 3 };
+		size_t time_intervals_count{ 40 };
+		size_t frame_temporal_size{ 25 };
+		constexpr size_t scenario_count{ 3 };
+
+		using Kernel = Convolution::BaseKernel<Convolution::KernelConstStep>;
+		using Kernels = std::array<Kernel, 2>;
+		Convolution::KernelConstStep kernelDesc{ source_count, frame_temporal_size };
+		Convolution::FluxConstStep fluxDesc{
+			source_count, time_intervals_count, frame_temporal_size };
+		// the kernels are extracted by every convolution,
+		// so every flux has its own copy of them
+		std::vector<Kernels> kernels;
+		for (size_t id = 0; id <= scenario_count; ++id)
+			kernels.push_back(Kernels{ {
+				{ rows_count, kernelDesc },
+				{ rows_count, kernelDesc } } });
+
+		Convolution::CommonFluxMulti<
+			Convolution::FluxConstStep, Convolution::EnsembleWellFlux, 2>
+			flux_ensemble{ fluxDesc, scenario_count };
+		std::array<Convolution::CommonFluxMulti<
+			Convolution::FluxConstStep, Convolution::BaseWellFlux, 2>, scenario_count>
+			flux_scenario{ { { fluxDesc }, { fluxDesc }, { fluxDesc } } };
+
+		std::array<std::vector<double>, scenario_count> qzi;
+		std::array<const double*, scenario_count> qzi_data;
+		std::vector<double> perm(source_count, 2.0);
+		bool sizes{ true };
+		RelativeError error;
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			if (nt < frame_temporal_size)
+				for (size_t id = 0; id < 2; ++id)
+				{
+					Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, source_count);
+					for (Kernels& copy : kernels)
+					{
+						copy[id].P_cur = P;
+						copy[id].advance();
+					}
+				}
+			for (size_t scenario = 0; scenario < scenario_count; ++scenario)
+			{
+				qzi[scenario].resize(source_count);
+				for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+					qzi[scenario][segm_id] = std::sin(0.1 * nt * (scenario + 1) + segm_id);
+				qzi_data[scenario] = qzi[scenario].data();
+				flux_scenario[scenario].push_coef(qzi[scenario].data(), perm.data());
+				flux_scenario[scenario].convolve(kernels[scenario + 1]);
+			}
+			flux_ensemble.push_coef(qzi_data.data(), perm.data());
+			flux_ensemble.convolve(kernels[0]);
+
+			for (size_t id = 0; id < 2; ++id)
+			{
+				sizes = sizes && flux_ensemble.size(id) == rows_count;
+				for (size_t scenario = 0; scenario < scenario_count; ++scenario)
+					for (size_t idx = 0; idx < rows_count; ++idx)
+					{
+						error.add(flux_scenario[scenario].result(idx, id),
+							flux_ensemble.result(idx, id, scenario));
+					}
+			}
+		}
+
+		std::cout << "Ensemble flux multi: " << scenario_count
+			<< " scenarios, relative error " << error.value() << std::endl;
+
+		return sizes && error.below(1e-12);
+	}
+
+	bool test_columnPartitionedEngine()
+	{
+		// a short and wide kernel, as the one of the fractures,
+		// in double and in float
+		const Eigen::MatrixXd kernel = Eigen::MatrixXd::Random(40, 3000);
+		const Eigen::MatrixXf kernel_float = kernel.cast<float>();
+		const Eigen::VectorXd flux = Eigen::VectorXd::Random(kernel.cols());
+		const Eigen::MatrixXd fluxes = Eigen::MatrixXd::Random(kernel.cols(), 3);
+
+		Eigen::VectorXd expected, expected_float;
+		Eigen::MatrixXd expected_ensemble;
+		Convolution::SequentialEngine::convolve(kernel, flux, expected);
+		Convolution::SequentialEngine::convolve(kernel_float, flux, expected_float);
+		Convolution::SequentialEngine::convolve(kernel, fluxes, expected_ensemble);
+
+		const size_t pool_threads = Convolution::ThreadPool::instance().thread_count();
+		RelativeError error;
+		Eigen::VectorXd result;
+		Eigen::MatrixXd result_ensemble;
+		for (size_t thread_count : { 1, 2, 3, 8 })
+		{
+			Convolution::ThreadPool::instance().set_thread_count(thread_count);
+			// the second call reuses the memory of the result
+			for (size_t call = 0; call < 2; ++call)
+			{
+				Convolution::ColumnPartitionedEngine::convolve(kernel, flux, result);
+				error.add(expected, result);
+				Convolution::ColumnPartitionedEngine::convolve(kernel_float, flux, result);
+				error.add(expected_float, result);
+				Convolution::ColumnPartitionedEngine::convolve(kernel, fluxes, result_ensemble);
+				error.add(expected_ensemble, result_ensemble);
+			}
+		}
+		Convolution::ThreadPool::instance().set_thread_count(pool_threads);
+
+		std::cout << "Column partitioned engine: relative error "
+			<< error.value() << " for 1, 2, 3, 8 threads" << std::endl;
+
+		return error.below(1e-12);
+	}
+
+	bool test_partitionedEngines()
+	{
+		// tall kernels are split by rows, wide ones by cols
+		const std::array<Eigen::MatrixXd, 2> kernels{ {
+			Eigen::MatrixXd::Random(5000, 40),
+			Eigen::MatrixXd::Random(40, 3000) } };
+
+		const size_t pool_threads = Convolution::ThreadPool::instance().thread_count();
+		RelativeError error;
+		for (size_t thread_count : { 1, 2, 3, 8 })
+		{
+			Convolution::ThreadPool::instance().set_thread_count(thread_count);
+			for (const Eigen::MatrixXd& kernel : kernels)
+			{
+				// a single flux and an ensemble of them
+				const Eigen::VectorXd flux = Eigen::VectorXd::Random(kernel.cols());
+				const Eigen::MatrixXd fluxes = Eigen::MatrixXd::Random(kernel.cols(), 3);
+
+				Eigen::VectorXd expected, result;
+				Eigen::MatrixXd expected_ensemble, result_ensemble;
+				Convolution::SequentialEngine::convolve(kernel, flux, expected);
+				Convolution::SequentialEngine::convolve(kernel, fluxes, expected_ensemble);
+				auto check = [&](auto engine)
+				{
+					decltype(engine)::convolve(kernel, flux, result);
+					decltype(engine)::convolve(kernel, fluxes, result_ensemble);
+					error.add(expected, result);
+					error.add(expected_ensemble, result_ensemble);
+				};
+				check(Convolution::RowPartitionedEngine{});
+				check(Convolution::ColumnPartitionedEngine{});
+				check(Convolution::AutoPartitionedEngine{});
+			}
+		}
+		Convolution::ThreadPool::instance().set_thread_count(pool_threads);
+
+		std::cout << "Partitioned engines: relative error " << error.value()
+			<< " for 1, 2, 3, 8 threads" << std::endl;
+
+		return error.below(1e-12);
+	}
+
+	bool test_newtonConvolution()
+	{
+		size_t rows_count{ 300 };
+		size_t source_count{ 4 };
+		size_t time_intervals_count{ 30 };
+		size_t frame_temporal_size{ 20 };
+		// the last trial flux is accepted
+		size_t iteration_count{ 3 };
+
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseKernel<Convolution::KernelConstStep>
+			kernel_split{ rows_count, { source_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux{ { source_count, time_intervals_count, frame_temporal_size } };
+		Convolution::BaseWellFlux<Convolution::FluxConstStep>
+			flux_split{ { source_count, time_intervals_count, frame_temporal_size } };
+
+		std::vector<double> perm(source_count, 2.0);
+		std::vector<std::vector<double>> qzi(
+			iteration_count, std::vector<double>(source_count));
+		RelativeError error;
+		for (size_t nt = 0; nt < time_intervals_count; ++nt)
+		{
+			if (nt < frame_temporal_size)
+			{
+				Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, source_count);
+				kernel.P_cur = P;
+				kernel_split.P_cur = P;
+				kernel.advance();
+				kernel_split.advance();
+			}
+			for (size_t iteration = 0; iteration < iteration_count; ++iteration)
+				for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+					qzi[iteration][segm_id] =
+						std::sin(0.1 * nt + segm_id) + 0.1 * static_cast<double>(iteration);
+
+			// the reference pushes the accepted flux
+			flux.push_coef(qzi.back().data(), perm.data());
+			const Eigen::VectorXd accepted = flux.extract().convolve(kernel);
+			const Eigen::MatrixXd window = kernel.Kernel.middleCols(
+				kernel.window_begin(), kernel.allocator.extractor.current_window_size());
+			Eigen::VectorXd window_flux = flux();
+
+			// an initial guess, then the trial fluxes
+			flux_split.push_coef(qzi.front().data(), perm.data());
+			flux_split.extract();
+			flux_split.convolve_history(kernel_split);
+			for (size_t iteration = 0; iteration < iteration_count; ++iteration)
+			{
+				const Eigen::VectorXd trial =
+					flux_split.calc_coef(qzi[iteration].data(), perm.data()).matrix();
+				const Eigen::VectorXd& current =
+					flux_split.convolve_current(kernel_split, trial);
+
+				// convolve() with the trial flux of the current time step
+				window_flux.head(static_cast<Eigen::Index>(source_count)) = trial;
+				const Eigen::VectorXd expected = iteration + 1 == iteration_count ?
+					accepted : Eigen::VectorXd{ window * window_flux };
+				error.add(expected, current);
+			}
+		}
+
+		std::cout << "Newton convolution: history and current step, relative error "
+			<< error.value() << std::endl;
+
+		return error.below(1e-12);
+	}
+
+	bool test_mainStepBatch()
+	{
+		size_t rows_count{ 200 };
+		size_t source_count{ 3 };
+		size_t main_step_nmbr{ 8 };
+		size_t small_step_nmbr{ 4 };
+		// nmbr of main steps of the second part of the history
+		size_t M{ 3 };
+		size_t frame_temporal_size{ main_step_nmbr + M };
+
+		Convolution::KernelMainStep kernelDesc{
+			source_count, frame_temporal_size, M, small_step_nmbr, main_step_nmbr };
+		Convolution::BaseKernel<Convolution::KernelMainStep>
+			kernel{ rows_count, kernelDesc }, kernel_batch{ rows_count, kernelDesc };
+		Convolution::FluxMainStep fluxDesc{
+			source_count, main_step_nmbr, frame_temporal_size, small_step_nmbr };
+		Convolution::BaseWellFluxMainStep<Convolution::FluxMainStep>
+			flux{ fluxDesc }, flux_batch{ fluxDesc };
+
+		for (size_t nt = 0; nt < frame_temporal_size; ++nt)
+		{
+			Eigen::ArrayXXd P = Eigen::ArrayXXd::Random(rows_count, source_count);
+			kernel.P_cur = P;
+			kernel_batch.P_cur = P;
+			kernel.advance();
+			kernel_batch.advance();
+		}
+
+		// first part of the history
+		std::vector<double> qzi(source_count), perm(source_count, 2.0);
+		for (size_t nt = 0; nt < main_step_nmbr; ++nt)
+		{
+			for (size_t segm_id = 0; segm_id < source_count; ++segm_id)
+				qzi[segm_id] = std::sin(0.3 * nt + segm_id);
+			flux.push_coef(qzi.data(), perm.data());
+			flux_batch.push_coef(qzi.data(), perm.data());
+			flux.extract().convolve(kernel);
+			flux_batch.extract().convolve(kernel_batch);
+		}
+
+		// second part: a product per main step
+		// instead of a convolution per small step
+		bool sizes{ true };
+		RelativeError error;
+		for (size_t main_step = 0; main_step < M; ++main_step)
+		{
+			flux_batch.extract_main_step();
+			const Eigen::MatrixXd batch = flux_batch.convolve_main_step(kernel_batch);
+			sizes = sizes && batch.cols() == static_cast<Eigen::Index>(small_step_nmbr);
+			for (size_t step_id = 0; step_id < small_step_nmbr && sizes; ++step_id)
+			{
+				const Eigen::VectorXd expected = flux.extract().convolve(kernel);
+				error.add(expected, batch.col(static_cast<Eigen::Index>(step_id)));
+			}
+		}
+
+		std::cout << "Main step batch: " << M << " main steps of "
+			<< small_step_nmbr << " small steps, relative error "
+			<< error.value() << std::endl;
+
+		return sizes && error.below(1e-12);
+	}
+
+	bool test_fracKernelZeroInit()
+	{
+		size_t rows_count{ 300 };
+		size_t source_count{ 4 };
+		size_t frame_temporal_size{ 10 };
+		Convolution::KernelConstStep kernelDesc{ source_count, frame_temporal_size };
+
+		// the memory of a kernel with non-zero lags
+		// is likely to be reused by the next one
+		{
+			Convolution::FracKernel<Convolution::KernelConstStep>
+				used{ rows_count, kernelDesc };
+			used.Kernel.setConstant(1.0);
+		}
+		Convolution::FracKernel<Convolution::KernelConstStep>
+			frac{ rows_count, kernelDesc };
+		const bool zero_new = frac.Kernel.cwiseAbs().maxCoeff() == 0.0;
+
+		// a single term R*(U - 0) at the first time step
+		const Eigen::ArrayXXd U = Eigen::ArrayXXd::Random(rows_count, source_count);
+		const Eigen::ArrayXd R = Eigen::ArrayXd::Random(rows_count);
+		frac.push_coef(R.data(), U.data());
+		const Eigen::MatrixXd expected = (U.colwise() * R).matrix();
+		const bool first_term =
+			frac.Kernel.leftCols(static_cast<Eigen::Index>(source_count)) == expected;
+		frac.advance();
+
+		frac.reset_kernel();
+		const bool zero_reset = frac.Kernel.cwiseAbs().maxCoeff() == 0.0;
+
+		std::cout << "Fracture kernel zero init: "
+			<< (zero_new ? "new kernel is zero" : "new kernel is not zero") << ", "
+			<< (zero_reset ? "reset kernel is zero" : "reset kernel is not zero")
+			<< std::endl;
+
+		return zero_new && first_term && zero_reset;
+	}
+
+	bool test_threadPoolJobs()
+	{
+		size_t job_count{ 20000 };
+		const size_t max_task_count{ 16 };
+
+		// the jobs are short, so the workers of a job
+		// are still waking up when the next job starts
+		Convolution::ThreadPool pool{ 8 };
+		bool once{ true };
+		for (size_t job = 0; job < job_count; ++job)
+		{
+			const size_t task_count = 2 + job % (max_task_count - 1);
+			std::array<std::atomic<size_t>, max_task_count> runs{};
+			pool.parallel_for(task_count, [&runs](size_t idx) {
+				runs[idx].fetch_add(1, std::memory_order_relaxed); });
+			for (size_t idx = 0; idx < max_task_count; ++idx)
+				once = once && runs[idx].load() == (idx < task_count ? 1u : 0u);
+		}
+
+		std::cout << "ThreadPool: " << job_count << " jobs, "
+			<< (once ? "every task run once" : "a task run twice or skipped")
+			<< std::endl;
+
+		return once;
+	}
 }
@@ -15,5 +15,182 @@ namespace Tests
 	bool test_kernelConstStep();
 
 	bool test_baseKernel_constStep();
+
+	/**
+	 * @brief Push and extract more time moments
+	 * than the ring can store, the windows and the convolutions
+	 * of a flux in the ring are the ones of FluxConstStep
+	 */
+	bool test_fluxRingStep();
+
+	/**
+	 * @brief Compare BlockFFTConvolver with
+	 * the direct convolution in the ConstStep regime
+	 */
+	bool test_blockFFTConvolver();
+
+	/**
+	 * @brief Compare ExponentialKernel with
+	 * the direct convolution for a smoothly decaying kernel
+	 */
+	bool test_exponentialKernel();
+
+	/**
+	 * @brief The nmbr of bins of the MultiLevel flux
+	 * grows logarithmically, and the bins cover
+	 * the frame. The convolution of the bins
+	 * with a CumulativeKernel equals the direct one
+	 * if the flux is constant within every bin
+	 */
+	bool test_fluxMultiLevel();
+
+	/**
+	 * @brief A kernel mapped to a scratch file
+	 * in the default directory, BaseKernelFile or WellKernelFile,
+	 * gives the same Kernel as the one in RAM,
+	 * and it is not created without a directory,
+	 * while a WellKernel is in RAM
+	 */
+	bool test_baseKernelFile();
+
+	/**
+	 * @brief A kernel stored in float is convolved
+	 * in double, its error is within the precision report
+	 */
+	bool test_kernelStorageFloat();
+
+	/**
+	 * @brief A kernel loaded from KernelCache
+	 * continues as the kernel it was saved from
+	 */
+	bool test_kernelCache();
+
+	/**
+	 * @brief A simulation restored from CheckpointLog
+	 * continues as the one it was written from
+	 */
+	bool test_checkpointLog();
+
+	/**
+	 * @brief A decaying kernel stops at the detected
+	 * external boundary, the convolution stays within the tolerance
+	 */
+	bool test_adaptiveExternalBoundary();
+
+	/**
+	 * @brief A kernel stored by row bands
+	 * is convolved as the dense one,
+	 * and only the rows reached by the front are multiplied
+	 */
+	bool test_rowBandedKernel();
+
+	/**
+	 * @brief Convolution by parts of a piecewise constant rate
+	 * with a cumulative kernel equals the convolution
+	 * with the lag kernel
+	 */
+	bool test_convolveByParts();
+
+	/**
+	 * @brief No memory is allocated by advance() and
+	 * convolution once the time stepping is warmed up
+	 */
+	bool test_zeroAllocationStepping();
+
+	/**
+	 * @brief The coefficients written in place through
+	 * coef_writer() give the same kernels as push_coef()
+	 */
+	bool test_coefWriter();
+
+	/**
+	 * @brief advance() fused with the convolution
+	 * gives the same kernel and convolution as
+	 * advance() followed by convolve()
+	 */
+	bool test_fusedAdvanceConvolve();
+
+	/**
+	 * @brief The fracture kernels packed into a single matrix
+	 * give the same convolution as the separate ones
+	 */
+	bool test_packedFracKernels();
+
+	/**
+	 * @brief The fractures convolved concurrently by the reduction tree
+	 * give the same result, bit for bit, for any number of threads
+	 */
+	bool test_deterministicFracReduction();
+
+	/**
+	 * @brief The fractures pushed concurrently by their ids,
+	 * in any order, give the same convolution as the round-robin push,
+	 * a time step may be convolved twice,
+	 * and a fracture left out is reported
+	 */
+	bool test_indexedFracPush();
+
+	/**
+	 * @brief Several terms pushed to a fracture kernel at once
+	 * give the same kernel as the terms pushed one by one
+	 */
+	bool test_batchedFracPush();
+
+	/**
+	 * @brief A kernel without F storage gives the same Kernel
+	 * as the full one with F == 1
+	 */
+	bool test_kernelCoefPolicies();
+
+	/**
+	 * @brief The MainStep flux storing the history once
+	 * gives the same averaged windows as BaseFluxContainerMainStep
+	 */
+	bool test_interpolatedFluxMainStep();
+
+	/**
+	 * @brief The results of CommonFluxMulti of an ensemble flux
+	 * are the ones of the per-scenario fluxes
+	 */
+	bool test_ensembleFluxMulti();
+
+	/**
+	 * @brief ColumnPartitionedEngine gives the product of SequentialEngine
+	 * for a short and wide kernel, a single flux and an ensemble,
+	 * for several thread counts
+	 */
+	bool test_columnPartitionedEngine();
+
+	/**
+	 * @brief The row, column and auto partitioned engines
+	 * give the product of SequentialEngine for several thread counts
+	 */
+	bool test_partitionedEngines();
+
+	/**
+	 * @brief convolve_history() plus convolve_current()
+	 * equals convolve() for every trial flux
+	 * of the Newton iterations of a time step
+	 */
+	bool test_newtonConvolution();
+
+	/**
+	 * @brief Every column of convolve_main_step()
+	 * equals convolve() at the respective small step
+	 */
+	bool test_mainStepBatch();
+
+	/**
+	 * @brief A new fracture kernel and a fracture kernel
+	 * after reset_kernel() have zero lag blocks,
+	 * so push_coef() adds its terms to zeros
+	 */
+	bool test_fracKernelZeroInit();
+
+	/**
+	 * @brief Every task of many short jobs in a row
+	 * is run exactly once by ThreadPool::parallel_for()
+	 */
+	bool test_threadPoolJobs();
 };
 